@@ -0,0 +1,113 @@
+/*
+ * Pound - the reverse-proxy load-balancer
+ * Copyright (C) 2002-2010 Apsis GmbH
+ *
+ * This file is part of Pound.
+ *
+ * Pound is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact information:
+ * Apsis GmbH
+ * P.O.Box
+ * 8707 Uetikon am See
+ * Switzerland
+ * EMail: roseg@apsis.ch
+ */
+
+/*
+ * Random back-end picks
+ *
+ * A back-end set carries an alias table (Vose): a pick is one random slot and
+ * one random comparison, whatever the number of back-ends. Kept apart from
+ * svc.c so that alias_bench can time the picks on their own.
+ */
+
+#include    "pound.h"
+
+/*
+ * Per-thread pseudo-random numbers (xorshift64*) - random() takes a lock
+ */
+static __thread unsigned long long  be_seed = 0;
+
+unsigned int
+be_rand(void)
+{
+    if(be_seed == 0)
+        be_seed = ((unsigned long long)pthread_self() ^ ((unsigned long long)mono_ms() << 20)) | 1;
+    be_seed ^= be_seed >> 12;
+    be_seed ^= be_seed << 25;
+    be_seed ^= be_seed >> 27;
+    return (unsigned int)((be_seed * 2685821657736338717ULL) >> 32);
+}
+
+/*
+ * Pick a random back-end, in proportion to the priorities (alias method):
+ * a random slot, then either its own back-end or its alias
+ */
+BACKEND *
+rand_backend(const BE_SET *set)
+{
+    int i;
+
+    i = (int)(((unsigned long long)be_rand() * set->n) >> 32);
+    return set->be[(int)(be_rand() % set->tot_pri) < set->prob[i]? i: set->alias[i]];
+}
+
+/*
+ * build the alias table of a set (Vose): slot i holds back-end i with
+ * probability prob[i] / tot_pri, otherwise back-end alias[i]
+ */
+int
+alias_build(BE_SET *set)
+{
+    long    *w;
+    int     *small, *large, n_small, n_large, i, l;
+
+    if((w = (long *)malloc(set->n * sizeof(long))) == NULL)
+        return -1;
+    if((small = (int *)malloc(2 * set->n * sizeof(int))) == NULL) {
+        free(w);
+        return -1;
+    }
+    large = small + set->n;
+    /* priorities scaled so that the average is exactly tot_pri */
+    for(n_small = n_large = i = 0; i < set->n; i++)
+        if((w[i] = (long)set->be[i]->priority * set->n) < set->tot_pri)
+            small[n_small++] = i;
+        else
+            large[n_large++] = i;
+    while(n_small > 0 && n_large > 0) {
+        i = small[--n_small];
+        l = large[n_large - 1];
+        set->prob[i] = w[i];
+        set->alias[i] = l;
+        if((w[l] -= set->tot_pri - w[i]) < set->tot_pri) {
+            n_large--;
+            small[n_small++] = l;
+        }
+    }
+    while(n_large > 0) {
+        i = large[--n_large];
+        set->prob[i] = set->tot_pri;
+        set->alias[i] = i;
+    }
+    while(n_small > 0) {
+        i = small[--n_small];
+        set->prob[i] = set->tot_pri;
+        set->alias[i] = i;
+    }
+    free(small);
+    free(w);
+    return 0;
+}
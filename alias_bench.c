@@ -0,0 +1,128 @@
+/*
+ * Pound - the reverse-proxy load-balancer
+ * Copyright (C) 2002-2010 Apsis GmbH
+ *
+ * This file is part of Pound.
+ *
+ * Pound is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact information:
+ * Apsis GmbH
+ * P.O.Box
+ * 8707 Uetikon am See
+ * Switzerland
+ * EMail: roseg@apsis.ch
+ */
+
+/*
+ * Time the random back-end picks (alias.c) for sets of 2 to 10000 back-ends
+ *
+ * Every set gets priorities 1 to 9; the table is checked to give each back-end
+ * exactly its share before the picks are timed. A pick should cost about the
+ * same whatever the number of back-ends.
+ */
+
+#include    "pound.h"
+
+#define N_PICKS 10000000
+
+/* alias.c seeds its random numbers with it (pound.c has the real one) */
+unsigned long
+mono_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * the weight the table gives each back-end must be exactly its priority
+ */
+static int
+check_set(const BE_SET *set)
+{
+    long    *mass;
+    int     i, res;
+
+    if((mass = (long *)calloc(set->n, sizeof(long))) == NULL)
+        return -1;
+    for(i = 0; i < set->n; i++) {
+        mass[i] += set->prob[i];
+        if(set->alias[i] != i)
+            mass[set->alias[i]] += set->tot_pri - set->prob[i];
+    }
+    for(res = i = 0; i < set->n; i++)
+        if(mass[i] != (long)set->be[i]->priority * set->n)
+            res = -1;
+    free(mass);
+    return res;
+}
+
+static int
+bench(const int n)
+{
+    BE_SET          set;
+    BACKEND         *bes, *be;
+    struct timespec t0, t1;
+    unsigned long   sum;
+    double          ns;
+    int             i;
+
+    memset(&set, 0, sizeof(set));
+    if((bes = (BACKEND *)calloc(n, sizeof(BACKEND))) == NULL
+    || (set.be = (BACKEND **)calloc(n, sizeof(BACKEND *))) == NULL
+    || (set.prob = (int *)calloc(n, sizeof(int))) == NULL
+    || (set.alias = (int *)calloc(n, sizeof(int))) == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+    for(i = 0; i < n; i++) {
+        bes[i].priority = 1 + i % 9;
+        set.be[set.n++] = &bes[i];
+        set.tot_pri += bes[i].priority;
+    }
+    if(alias_build(&set) || check_set(&set)) {
+        fprintf(stderr, "%d back-ends: bad alias table\n", n);
+        return -1;
+    }
+    for(i = 0; i < N_PICKS / 10; i++)
+        rand_backend(&set);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for(sum = 0, i = 0; i < N_PICKS; i++) {
+        be = rand_backend(&set);
+        sum += be->priority;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    ns = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / N_PICKS;
+    /* the average priority picked: sum(priority^2) / tot_pri */
+    printf("%6d back-ends: %6.1f ns/pick (avg. priority %.3f)\n", n, ns, (double)sum / N_PICKS);
+    free(set.alias);
+    free(set.prob);
+    free(set.be);
+    free(bes);
+    return 0;
+}
+
+int
+main(const int argc, char **argv)
+{
+    static const int    sizes[] = { 2, 10, 100, 1000, 10000 };
+    int                 i;
+
+    for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        if(bench(sizes[i]))
+            return 1;
+    return 0;
+}
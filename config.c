@@ -78,18 +78,25 @@ static regex_t  Service, ServiceName, URL, HeadRequire, HeadDeny, BackEnd, Emerg
 static regex_t  Redirect, RedirectN, TimeOut, WSTimeOut, Session, Type, TTL, ID;
 static regex_t  ClientCert, AddHeader, DisableProto, SSLAllowClientRenegotiation, SSLHonorCipherOrder, Ciphers;
 static regex_t  CAlist, VerifyList, CRLlist, NoHTTPS11, Grace, Include, ConnTO, IgnoreCase, HTTPS;
-static regex_t  Disabled, Threads, CNName, Anonymise, ECDHCurve;
+static regex_t  Disabled, Threads, CNName, Anonymise, ECDHCurve, EventThreads, ParkIdle, Acceptors, QueueSize;
+static regex_t  MinThreads, MaxThreads, ThreadIdle, SpawnQueue, SpawnWait, MaxQueueWait, MaxQueueDepth;
+static regex_t  RelayFlush, PoolMaxIdle, PoolIdleTimeOut, PoolMaxRequests;
+static regex_t  HealthCheck, HCRequest, HCHeader, HCStatus, HCBody, MaxLatency, Rise, Fall;
+static regex_t  Balance, HashLoad;
+static regex_t  Outlier, ODErrors, ODErrorRate, ODLatency, ODMinRequests, ODEjectTime, ODMaxEjected;
 static regex_t  Plugin;
 static regex_t  LookUpBackEnd;
 
 static regmatch_t   matches[5];
 
-static char *xhttp[] = {
-    "^(GET|POST|HEAD) ([^ ]+) HTTP/1.[01]$",
-    "^(GET|POST|HEAD|PUT|PATCH|DELETE) ([^ ]+) HTTP/1.[01]$",
-    "^(GET|POST|HEAD|PUT|PATCH|DELETE|LOCK|UNLOCK|PROPFIND|PROPPATCH|SEARCH|MKCOL|MOVE|COPY|OPTIONS|TRACE|MKACTIVITY|CHECKOUT|MERGE|REPORT) ([^ ]+) HTTP/1.[01]$",
-    "^(GET|POST|HEAD|PUT|PATCH|DELETE|LOCK|UNLOCK|PROPFIND|PROPPATCH|SEARCH|MKCOL|MOVE|COPY|OPTIONS|TRACE|MKACTIVITY|CHECKOUT|MERGE|REPORT|SUBSCRIBE|UNSUBSCRIBE|BPROPPATCH|POLL|BMOVE|BCOPY|BDELETE|BPROPFIND|NOTIFY|CONNECT) ([^ ]+) HTTP/1.[01]$",
-    "^(GET|POST|HEAD|PUT|PATCH|DELETE|LOCK|UNLOCK|PROPFIND|PROPPATCH|SEARCH|MKCOL|MOVE|COPY|OPTIONS|TRACE|MKACTIVITY|CHECKOUT|MERGE|REPORT|SUBSCRIBE|UNSUBSCRIBE|BPROPPATCH|POLL|BMOVE|BCOPY|BDELETE|BPROPFIND|NOTIFY|CONNECT|RPC_IN_DATA|RPC_OUT_DATA) ([^ ]+) HTTP/1.[01]$",
+/* allowed methods for each xHTTP level */
+#define XHTTP_UPTO(m)   ((m) == METH_RPC_OUT_DATA? ~0U: (1U << ((m) + 1)) - 1)
+static const unsigned int xhttp[] = {
+    XHTTP_UPTO(METH_HEAD),
+    XHTTP_UPTO(METH_DELETE),
+    XHTTP_UPTO(METH_REPORT),
+    XHTTP_UPTO(METH_CONNECT),
+    XHTTP_UPTO(METH_RPC_OUT_DATA),
 };
 
 static int  log_level = 1;
@@ -98,6 +105,9 @@ static int  clnt_to = 10;
 static int  be_to = 15;
 static int  ws_to = 600;
 static int  be_connto = 15;
+static int  be_pool_max = 0;
+static int  be_pool_to = 4;
+static int  be_pool_reqs = 0;
 static int  ignore_case = 0;
 #if OPENSSL_VERSION_NUMBER >= 0x0090800fL
 #ifndef OPENSSL_NO_ECDH
@@ -243,6 +253,115 @@ get_subjectaltnames(X509 *x509, unsigned int *count)
     return result;
 }
 
+/*
+ * parse an HTTP health check
+ */
+static HEALTH *
+parse_health(void)
+{
+    char        lin[MAXBUF], *cp;
+    HEALTH      *res;
+    int         len;
+
+    if((res = (HEALTH *)malloc(sizeof(HEALTH))) == NULL)
+        conf_err("HealthCheck config: out of memory - aborted");
+    memset(res, 0, sizeof(HEALTH));
+    res->rise = res->fall = 1;
+    while(conf_fgets(lin, MAXBUF)) {
+        if(strlen(lin) > 0 && lin[strlen(lin) - 1] == '\n')
+            lin[strlen(lin) - 1] = '\0';
+        if(!regexec(&HCRequest, lin, 4, matches, 0)) {
+            if(res->req != NULL)
+                conf_err("Multiple Requests in one HealthCheck - aborted");
+            lin[matches[1].rm_eo] = '\0';
+            if((res->req = (char *)malloc(strlen(lin + matches[1].rm_so) + 3)) == NULL)
+                conf_err("HealthCheck config: out of memory - aborted");
+            sprintf(res->req, "%s\r\n", lin + matches[1].rm_so);
+        } else if(!regexec(&HCHeader, lin, 4, matches, 0)) {
+            if(res->req == NULL)
+                conf_err("Header before Request in HealthCheck - aborted");
+            lin[matches[1].rm_eo] = '\0';
+            cp = lin + matches[1].rm_so;
+            if(!strncasecmp(cp, "Host:", 5))
+                res->has_host = 1;
+            len = strlen(res->req);
+            if((res->req = (char *)realloc(res->req, len + strlen(cp) + 3)) == NULL)
+                conf_err("HealthCheck config: out of memory - aborted");
+            sprintf(res->req + len, "%s\r\n", cp);
+        } else if(!regexec(&HCStatus, lin, 4, matches, 0)) {
+            res->status = atoi(lin + matches[1].rm_so);
+        } else if(!regexec(&HCBody, lin, 4, matches, 0)) {
+            if(res->has_body)
+                conf_err("Multiple Body patterns in one HealthCheck - aborted");
+            lin[matches[1].rm_eo] = '\0';
+            if(regcomp(&res->body, lin + matches[1].rm_so, REG_ICASE | REG_NEWLINE | REG_EXTENDED))
+                conf_err("Body bad pattern - aborted");
+            res->has_body = 1;
+        } else if(!regexec(&MaxLatency, lin, 4, matches, 0)) {
+            res->max_lat = atoi(lin + matches[1].rm_so);
+        } else if(!regexec(&Rise, lin, 4, matches, 0)) {
+            res->rise = atoi(lin + matches[1].rm_so);
+        } else if(!regexec(&Fall, lin, 4, matches, 0)) {
+            res->fall = atoi(lin + matches[1].rm_so);
+        } else if(!regexec(&End, lin, 4, matches, 0)) {
+            if(res->req == NULL)
+                conf_err("HealthCheck Request not defined - aborted");
+            return res;
+        } else {
+            conf_err("unknown directive");
+        }
+    }
+
+    conf_err("HealthCheck premature EOF");
+    return NULL;
+}
+
+/*
+ * parse the outlier detection of a service
+ */
+static OUTLIER *
+parse_outlier(void)
+{
+    char        lin[MAXBUF];
+    OUTLIER     *res;
+
+    if((res = (OUTLIER *)malloc(sizeof(OUTLIER))) == NULL)
+        conf_err("Outlier config: out of memory - aborted");
+    memset(res, 0, sizeof(OUTLIER));
+    res->errors = 5;
+    res->min_req = 10;
+    res->eject = 30;
+    res->max_eject = 50;
+    while(conf_fgets(lin, MAXBUF)) {
+        if(strlen(lin) > 0 && lin[strlen(lin) - 1] == '\n')
+            lin[strlen(lin) - 1] = '\0';
+        if(!regexec(&ODErrors, lin, 4, matches, 0)) {
+            res->errors = atoi(lin + matches[1].rm_so);
+        } else if(!regexec(&ODErrorRate, lin, 4, matches, 0)) {
+            if((res->err_rate = atoi(lin + matches[1].rm_so)) > 100)
+                conf_err("ErrorRate must be at most 100 - aborted");
+        } else if(!regexec(&ODLatency, lin, 4, matches, 0)) {
+            res->slow_ms = atoi(lin + matches[1].rm_so);
+            if((res->slow_rate = atoi(lin + matches[2].rm_so)) > 100)
+                conf_err("Latency percentage must be at most 100 - aborted");
+        } else if(!regexec(&ODMinRequests, lin, 4, matches, 0)) {
+            res->min_req = atoi(lin + matches[1].rm_so);
+        } else if(!regexec(&ODEjectTime, lin, 4, matches, 0)) {
+            res->eject = atoi(lin + matches[1].rm_so);
+        } else if(!regexec(&ODMaxEjected, lin, 4, matches, 0)) {
+            if((res->max_eject = atoi(lin + matches[1].rm_so)) > 100)
+                conf_err("MaxEjected must be at most 100 - aborted");
+        } else if(!regexec(&End, lin, 4, matches, 0)) {
+            return res;
+        } else {
+            conf_err("unknown directive");
+        }
+    }
+
+    conf_err("Outlier premature EOF");
+    return NULL;
+}
+
 /*
  * parse a back-end
  */
@@ -265,6 +384,10 @@ parse_be(const int is_emergency, const char *name)
     res->to = is_emergency? 120: be_to;
     res->conn_to = is_emergency? 120: be_connto;
     res->ws_to = is_emergency? 120: ws_to;
+    res->pool_max = be_pool_max;
+    res->pool_to = be_pool_to;
+    res->pool_reqs = be_pool_reqs;
+    res->alive_to = alive_to;
     res->alive = 1;
     memset(&res->addr, 0, sizeof(res->addr));
     res->priority = 5;
@@ -319,6 +442,20 @@ parse_be(const int is_emergency, const char *name)
             res->ws_to = atoi(lin + matches[1].rm_so);
         } else if(!regexec(&ConnTO, lin, 4, matches, 0)) {
             res->conn_to = atoi(lin + matches[1].rm_so);
+        } else if(!regexec(&Alive, lin, 4, matches, 0)) {
+            res->alive_to = atoi(lin + matches[1].rm_so);
+        } else if(!regexec(&PoolMaxIdle, lin, 4, matches, 0)) {
+            res->pool_max = atoi(lin + matches[1].rm_so);
+        } else if(!regexec(&PoolIdleTimeOut, lin, 4, matches, 0)) {
+            res->pool_to = atoi(lin + matches[1].rm_so);
+        } else if(!regexec(&PoolMaxRequests, lin, 4, matches, 0)) {
+            res->pool_reqs = atoi(lin + matches[1].rm_so);
+        } else if(!regexec(&HealthCheck, lin, 4, matches, 0)) {
+            if(is_emergency)
+                conf_err("HealthCheck is not supported for Emergency back-ends");
+            if(res->health != NULL)
+                conf_err("Multiple HealthChecks in one BackEnd - aborted");
+            res->health = parse_health();
         } else if(!regexec(&HAport, lin, 4, matches, 0)) {
             if(is_emergency)
                 conf_err("HAport is not supported for Emergency back-ends");
@@ -383,6 +520,9 @@ parse_be(const int is_emergency, const char *name)
             SSL_CTX_clear_options(res->ctx, SSL_OP_LEGACY_SERVER_CONNECT);
             sprintf(lin, "%d-Pound-%ld", getpid(), random());
             SSL_CTX_set_session_id_context(res->ctx, (unsigned char *)lin, strlen(lin));
+            /* sessions (IDs and tickets) are kept per back-end, not in the CTX cache */
+            SSL_CTX_set_session_cache_mode(res->ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+            SSL_CTX_sess_set_new_cb(res->ctx, be_new_session);
             SSL_CTX_set_tmp_rsa_callback(res->ctx, RSA_tmp_callback);
             SSL_CTX_set_tmp_dh_callback(res->ctx, DH_tmp_callback);
 #if OPENSSL_VERSION_NUMBER >= 0x0090800fL
@@ -580,7 +720,7 @@ static IMPLEMENT_LHASH_COMP_FN(t_cmp, const TABNODE *)
 static SERVICE *
 parse_service(const char *svc_name)
 {
-    char        lin[MAXBUF];
+    char        lin[MAXBUF], *cp;
     SERVICE     *res;
     BACKEND     *be;
     MATCHER     *m;
@@ -590,6 +730,7 @@ parse_service(const char *svc_name)
         conf_err("Service config: out of memory - aborted");
     memset(res, 0, sizeof(SERVICE));
     res->sess_type = SESS_NONE;
+    res->balance = BAL_RANDOM;
     pthread_mutex_init(&res->mut, NULL);
     if(svc_name)
         strncpy(res->name, svc_name, KEY_SIZE);
@@ -724,6 +865,26 @@ parse_service(const char *svc_name)
             res->emergency = parse_be(1, NULL);
         } else if(!regexec(&Session, lin, 4, matches, 0)) {
             parse_sess(res);
+        } else if(!regexec(&Balance, lin, 4, matches, 0)) {
+            lin[matches[1].rm_eo] = '\0';
+            cp = lin + matches[1].rm_so;
+            if(!strcasecmp(cp, "Random"))
+                res->balance = BAL_RANDOM;
+            else if(!strcasecmp(cp, "LeastTime"))
+                res->balance = BAL_LEASTTIME;
+            else if(!strcasecmp(cp, "LeastConn"))
+                res->balance = BAL_LEASTCONN;
+            else if(!strcasecmp(cp, "RoundRobin"))
+                res->balance = BAL_ROUNDROBIN;
+            else
+                conf_err("Unknown Balance type");
+        } else if(!regexec(&HashLoad, lin, 4, matches, 0)) {
+            if((res->hash_load = atoi(lin + matches[1].rm_so)) < 100)
+                conf_err("HashLoad must be at least 100 - aborted");
+        } else if(!regexec(&Outlier, lin, 4, matches, 0)) {
+            if(res->outlier != NULL)
+                conf_err("Multiple Outlier blocks in one Service - aborted");
+            res->outlier = parse_outlier();
         } else if(!regexec(&IgnoreCase, lin, 4, matches, 0)) {
             ign_case = atoi(lin + matches[1].rm_so);
         } else if(!regexec(&Disabled, lin, 4, matches, 0)) {
@@ -755,6 +916,8 @@ parse_service(const char *svc_name)
                     res->tot_pri += be->priority;
                 res->abs_pri += be->priority;
             }
+            if(be_publish(res))
+                conf_err("Service config: out of memory - aborted");
             return res;
         } else {
             conf_err("unknown directive");
@@ -812,8 +975,7 @@ parse_HTTP(void)
     res->err501 = "This method may not be used.";
     res->err503 = "The service is not available. Please try again later.";
     res->log_level = log_level;
-    if(regcomp(&res->verb, xhttp[0], REG_ICASE | REG_NEWLINE | REG_EXTENDED))
-        conf_err("xHTTP bad default pattern - aborted");
+    res->verb = xhttp[0];
     has_addr = has_port = 0;
     while(conf_fgets(lin, MAXBUF)) {
         if(strlen(lin) > 0 && lin[strlen(lin) - 1] == '\n')
@@ -845,11 +1007,13 @@ parse_HTTP(void)
             int n;
 
             n = atoi(lin + matches[1].rm_so);
-            regfree(&res->verb);
-            if(regcomp(&res->verb, xhttp[n], REG_ICASE | REG_NEWLINE | REG_EXTENDED))
-                conf_err("xHTTP bad pattern - aborted");
+            res->verb = xhttp[n];
         } else if(!regexec(&Client, lin, 4, matches, 0)) {
             res->to = atoi(lin + matches[1].rm_so);
+        } else if(!regexec(&MaxQueueWait, lin, 4, matches, 0)) {
+            res->max_qwait = atoi(lin + matches[1].rm_so);
+        } else if(!regexec(&MaxQueueDepth, lin, 4, matches, 0)) {
+            res->max_qdepth = atoi(lin + matches[1].rm_so);
         } else if(!regexec(&CheckURL, lin, 4, matches, 0)) {
             if(res->has_pat)
                 conf_err("CheckURL multiple pattern - aborted");
@@ -1015,8 +1179,7 @@ parse_HTTPS(void)
     res->err503 = "The service is not available. Please try again later.";
     res->allow_client_reneg = 0;
     res->log_level = log_level;
-    if(regcomp(&res->verb, xhttp[0], REG_ICASE | REG_NEWLINE | REG_EXTENDED))
-        conf_err("xHTTP bad default pattern - aborted");
+    res->verb = xhttp[0];
     has_addr = has_port = has_other = 0;
     while(conf_fgets(lin, MAXBUF)) {
         if(strlen(lin) > 0 && lin[strlen(lin) - 1] == '\n')
@@ -1043,11 +1206,13 @@ parse_HTTPS(void)
             int n;
 
             n = atoi(lin + matches[1].rm_so);
-            regfree(&res->verb);
-            if(regcomp(&res->verb, xhttp[n], REG_ICASE | REG_NEWLINE | REG_EXTENDED))
-                conf_err("xHTTP bad pattern - aborted");
+            res->verb = xhttp[n];
         } else if(!regexec(&Client, lin, 4, matches, 0)) {
             res->to = atoi(lin + matches[1].rm_so);
+        } else if(!regexec(&MaxQueueWait, lin, 4, matches, 0)) {
+            res->max_qwait = atoi(lin + matches[1].rm_so);
+        } else if(!regexec(&MaxQueueDepth, lin, 4, matches, 0)) {
+            res->max_qdepth = atoi(lin + matches[1].rm_so);
         } else if(!regexec(&CheckURL, lin, 4, matches, 0)) {
             if(res->has_pat)
                 conf_err("CheckURL multiple pattern - aborted");
@@ -1396,6 +1561,34 @@ parse_file(void)
             daemonize = atoi(lin + matches[1].rm_so);
         } else if(!regexec(&Threads, lin, 4, matches, 0)) {
             numthreads = atoi(lin + matches[1].rm_so);
+        } else if(!regexec(&EventThreads, lin, 4, matches, 0)) {
+#if HAVE_SYS_EPOLL_H
+            ev_threads = atoi(lin + matches[1].rm_so);
+#else
+            conf_err("EventThreads is not supported on this platform - aborted");
+#endif
+        } else if(!regexec(&ParkIdle, lin, 4, matches, 0)) {
+#if HAVE_SYS_EPOLL_H
+            park_idle = atoi(lin + matches[1].rm_so);
+#else
+            conf_err("ParkIdle is not supported on this platform - aborted");
+#endif
+        } else if(!regexec(&Acceptors, lin, 4, matches, 0)) {
+            acceptors = atoi(lin + matches[1].rm_so);
+        } else if(!regexec(&QueueSize, lin, 4, matches, 0)) {
+            queue_size = atoi(lin + matches[1].rm_so);
+        } else if(!regexec(&MinThreads, lin, 4, matches, 0)) {
+            min_threads = atoi(lin + matches[1].rm_so);
+        } else if(!regexec(&MaxThreads, lin, 4, matches, 0)) {
+            max_threads = atoi(lin + matches[1].rm_so);
+        } else if(!regexec(&ThreadIdle, lin, 4, matches, 0)) {
+            thread_idle = atoi(lin + matches[1].rm_so);
+        } else if(!regexec(&SpawnQueue, lin, 4, matches, 0)) {
+            spawn_queue = atoi(lin + matches[1].rm_so);
+        } else if(!regexec(&SpawnWait, lin, 4, matches, 0)) {
+            spawn_wait = atoi(lin + matches[1].rm_so);
+        } else if(!regexec(&RelayFlush, lin, 4, matches, 0)) {
+            relay_flush = atoi(lin + matches[1].rm_so);
         } else if(!regexec(&LogFacility, lin, 4, matches, 0)) {
             lin[matches[1].rm_eo] = '\0';
             if(lin[matches[1].rm_so] == '-')
@@ -1420,6 +1613,12 @@ parse_file(void)
             ws_to = atoi(lin + matches[1].rm_so);
         } else if(!regexec(&ConnTO, lin, 4, matches, 0)) {
             be_connto = atoi(lin + matches[1].rm_so);
+        } else if(!regexec(&PoolMaxIdle, lin, 4, matches, 0)) {
+            be_pool_max = atoi(lin + matches[1].rm_so);
+        } else if(!regexec(&PoolIdleTimeOut, lin, 4, matches, 0)) {
+            be_pool_to = atoi(lin + matches[1].rm_so);
+        } else if(!regexec(&PoolMaxRequests, lin, 4, matches, 0)) {
+            be_pool_reqs = atoi(lin + matches[1].rm_so);
         } else if(!regexec(&IgnoreCase, lin, 4, matches, 0)) {
             ignore_case = atoi(lin + matches[1].rm_so);
 #if OPENSSL_VERSION_NUMBER >= 0x0090800fL
@@ -1512,6 +1711,38 @@ config_parse(const int argc, char **const argv)
     || regcomp(&RootJail, "^[ \t]*RootJail[ \t]+\"(.+)\"[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
     || regcomp(&Daemon, "^[ \t]*Daemon[ \t]+([01])[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
     || regcomp(&Threads, "^[ \t]*Threads[ \t]+([1-9][0-9]*)[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&EventThreads, "^[ \t]*EventThreads[ \t]+([0-9]+)[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&ParkIdle, "^[ \t]*ParkIdle[ \t]+([01])[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&Acceptors, "^[ \t]*Acceptors[ \t]+([0-9]+)[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&QueueSize, "^[ \t]*QueueSize[ \t]+([1-9][0-9]*)[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&MinThreads, "^[ \t]*MinThreads[ \t]+([1-9][0-9]*)[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&MaxThreads, "^[ \t]*MaxThreads[ \t]+([1-9][0-9]*)[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&ThreadIdle, "^[ \t]*ThreadIdle[ \t]+([1-9][0-9]*)[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&SpawnQueue, "^[ \t]*SpawnQueue[ \t]+([1-9][0-9]*)[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&SpawnWait, "^[ \t]*SpawnWait[ \t]+([0-9]+)[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&RelayFlush, "^[ \t]*RelayFlush[ \t]+([01])[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&PoolMaxIdle, "^[ \t]*PoolMaxIdle[ \t]+([0-9]+)[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&PoolIdleTimeOut, "^[ \t]*PoolIdleTimeOut[ \t]+([1-9][0-9]*)[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&PoolMaxRequests, "^[ \t]*PoolMaxRequests[ \t]+([0-9]+)[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&HealthCheck, "^[ \t]*HealthCheck[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&HCRequest, "^[ \t]*Request[ \t]+\"(.+)\"[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&HCHeader, "^[ \t]*Header[ \t]+\"(.+)\"[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&HCStatus, "^[ \t]*Status[ \t]+([1-5][0-9][0-9])[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&HCBody, "^[ \t]*Body[ \t]+\"(.+)\"[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&MaxLatency, "^[ \t]*MaxLatency[ \t]+([0-9]+)[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&Rise, "^[ \t]*Rise[ \t]+([1-9][0-9]*)[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&HashLoad, "^[ \t]*HashLoad[ \t]+([0-9]+)[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&Balance, "^[ \t]*Balance[ \t]+([a-z]+)[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&Outlier, "^[ \t]*Outlier[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&ODErrors, "^[ \t]*Errors[ \t]+([0-9]+)[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&ODErrorRate, "^[ \t]*ErrorRate[ \t]+([0-9]+)[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&ODLatency, "^[ \t]*Latency[ \t]+([1-9][0-9]*)[ \t]+([0-9]+)[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&ODMinRequests, "^[ \t]*MinRequests[ \t]+([0-9]+)[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&ODEjectTime, "^[ \t]*EjectTime[ \t]+([1-9][0-9]*)[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&ODMaxEjected, "^[ \t]*MaxEjected[ \t]+([0-9]+)[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&Fall, "^[ \t]*Fall[ \t]+([1-9][0-9]*)[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&MaxQueueWait, "^[ \t]*MaxQueueWait[ \t]+([0-9]+)[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    || regcomp(&MaxQueueDepth, "^[ \t]*MaxQueueDepth[ \t]+([0-9]+)[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
     || regcomp(&LogFacility, "^[ \t]*LogFacility[ \t]+([a-z0-9-]+)[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
     || regcomp(&LogLevel, "^[ \t]*LogLevel[ \t]+([0-5])[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
     || regcomp(&Grace, "^[ \t]*Grace[ \t]+([0-9]+)[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
@@ -1647,6 +1878,15 @@ config_parse(const int argc, char **const argv)
     ctrl_name = NULL;
 
     numthreads = 128;
+    ev_threads = 0;
+    park_idle = 0;
+    acceptors = 0;
+    queue_size = 8192;
+    min_threads = max_threads = 0;
+    thread_idle = 60;
+    spawn_queue = 8;
+    spawn_wait = 100;
+    relay_flush = 0;
     alive_to = 30;
     daemonize = 1;
     grace = 30;
@@ -1656,6 +1896,16 @@ config_parse(const int argc, char **const argv)
 
     parse_file();
 
+    /* the worker pool: Threads sets its size unless MinThreads/MaxThreads say otherwise */
+    if(min_threads == 0)
+        min_threads = (max_threads > 0 && max_threads < numthreads)? max_threads: numthreads;
+    if(max_threads == 0)
+        max_threads = min_threads;
+    if(min_threads > max_threads) {
+        logmsg(LOG_ERR, "MinThreads %d is larger than MaxThreads %d - aborted", min_threads, max_threads);
+        exit(1);
+    }
+
     if(check_only) {
         logmsg(LOG_INFO, "Config file %s is OK", conf_name);
         exit(0);
@@ -1673,6 +1923,38 @@ config_parse(const int argc, char **const argv)
     regfree(&RootJail);
     regfree(&Daemon);
     regfree(&Threads);
+    regfree(&EventThreads);
+    regfree(&ParkIdle);
+    regfree(&Acceptors);
+    regfree(&QueueSize);
+    regfree(&MinThreads);
+    regfree(&MaxThreads);
+    regfree(&ThreadIdle);
+    regfree(&SpawnQueue);
+    regfree(&SpawnWait);
+    regfree(&RelayFlush);
+    regfree(&PoolMaxIdle);
+    regfree(&PoolIdleTimeOut);
+    regfree(&PoolMaxRequests);
+    regfree(&HealthCheck);
+    regfree(&HCRequest);
+    regfree(&HCHeader);
+    regfree(&HCStatus);
+    regfree(&HCBody);
+    regfree(&MaxLatency);
+    regfree(&Rise);
+    regfree(&Fall);
+    regfree(&Balance);
+    regfree(&HashLoad);
+    regfree(&Outlier);
+    regfree(&ODErrors);
+    regfree(&ODErrorRate);
+    regfree(&ODLatency);
+    regfree(&ODMinRequests);
+    regfree(&ODEjectTime);
+    regfree(&ODMaxEjected);
+    regfree(&MaxQueueWait);
+    regfree(&MaxQueueDepth);
     regfree(&LogFacility);
     regfree(&LogLevel);
     regfree(&Grace);
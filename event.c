@@ -0,0 +1,372 @@
+/*
+ * Pound - the reverse-proxy load-balancer
+ * Copyright (C) 2002-2010 Apsis GmbH
+ *
+ * This file is part of Pound.
+ *
+ * Pound is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact information:
+ * Apsis GmbH
+ * P.O.Box
+ * 8707 Uetikon am See
+ * Switzerland
+ * EMail: roseg@apsis.ch
+ */
+
+/*
+ * The event engine
+ *
+ * A client connection spends most of its life waiting: for the first request
+ * after accept() and, with HTTP/1.1, for the next request on a keep-alive
+ * connection. Rather than have a worker thread block in get_headers() for all
+ * that time, such connections are parked here: a few event threads watch them
+ * with epoll and put them on the work queue as soon as the client sends
+ * something. The workers only ever see connections with a request to process.
+ *
+ * Without event threads (ParkIdle) there is a single shared epoll set instead,
+ * polled by whichever worker is idle: one of them leads and polls, the others
+ * wait on the work queue. The leader takes the first ready connection for
+ * itself, queues the others and hands the lead to the next idle worker. A
+ * self-pipe in the set calls the leader back when work is queued and nobody
+ * else is waiting for it.
+ */
+
+#include    "pound.h"
+
+#if HAVE_SYS_EPOLL_H
+
+#define EV_BATCH    256         /* max. events handled per epoll_wait */
+
+/* a parked connection */
+typedef struct _ev_ent {
+    thr_arg         arg;
+    time_t          expire;     /* when to give up on the client (0: never) */
+    struct _ev_ent  *prev, *next;
+}   EV_ENT;
+
+/* one per event thread */
+typedef struct {
+    int             epfd;
+    pthread_mutex_t mut;        /* protects the list of parked connections */
+    EV_ENT          head;       /* list head, oldest first */
+}   EV_LOOP;
+
+static EV_LOOP  *ev_loops = NULL;
+static int      n_loops = 0;
+
+/* shared mode - no event threads */
+static int      ev_pipe[2] = { -1, -1 };    /* wakes up the polling worker */
+static int      ev_leader = 0;              /* a worker is polling */
+static int      ev_woken = 0;               /* ... and has been woken up already */
+
+static void
+ev_link(EV_LOOP *const ev, EV_ENT *const ent)
+{
+    ent->next = &ev->head;
+    ent->prev = ev->head.prev;
+    ev->head.prev->next = ent;
+    ev->head.prev = ent;
+    return;
+}
+
+static void
+ev_unlink(EV_ENT *const ent)
+{
+    ent->prev->next = ent->next;
+    ent->next->prev = ent->prev;
+    ent->prev = ent->next = ent;
+    return;
+}
+
+/*
+ * prepare the event loops - called once, before the threads are started
+ */
+int
+init_event(void)
+{
+    struct epoll_event  e;
+    int                 i;
+
+    if(ev_threads > 0)
+        n_loops = ev_threads;
+    else if(park_idle)
+        n_loops = 1;
+    else
+        return 0;
+    if((ev_loops = (EV_LOOP *)calloc(n_loops, sizeof(EV_LOOP))) == NULL) {
+        logmsg(LOG_ERR, "event loops: out of memory");
+        return -1;
+    }
+    for(i = 0; i < n_loops; i++) {
+        if((ev_loops[i].epfd = epoll_create(1024)) < 0) {
+            logmsg(LOG_ERR, "epoll_create: %s", strerror(errno));
+            return -1;
+        }
+        fcntl(ev_loops[i].epfd, F_SETFD, FD_CLOEXEC);
+        pthread_mutex_init(&ev_loops[i].mut, NULL);
+        ev_loops[i].head.prev = ev_loops[i].head.next = &ev_loops[i].head;
+    }
+    if(ev_threads <= 0) {
+        if(pipe(ev_pipe)) {
+            logmsg(LOG_ERR, "event pipe: %s", strerror(errno));
+            return -1;
+        }
+        for(i = 0; i < 2; i++) {
+            fcntl(ev_pipe[i], F_SETFD, FD_CLOEXEC);
+            fcntl(ev_pipe[i], F_SETFL, fcntl(ev_pipe[i], F_GETFL) | O_NONBLOCK);
+        }
+        memset(&e, 0, sizeof(e));
+        e.events = EPOLLIN;
+        e.data.ptr = NULL;
+        if(epoll_ctl(ev_loops[0].epfd, EPOLL_CTL_ADD, ev_pipe[0], &e)) {
+            logmsg(LOG_ERR, "event pipe epoll_ctl: %s", strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * park a connection until the client sends something or the time-out expires
+ * returns 0 if the event engine took over the connection, -1 otherwise
+ */
+int
+ev_park(thr_arg *arg, const int to)
+{
+    EV_LOOP             *ev;
+    EV_ENT              *ent;
+    struct epoll_event  e;
+    int                 ret_val;
+
+    if(ev_loops == NULL)
+        return -1;
+    if((ent = (EV_ENT *)malloc(sizeof(EV_ENT))) == NULL) {
+        logmsg(LOG_WARNING, "(%lx) ev_park: out of memory", pthread_self());
+        return -1;
+    }
+    memcpy(&ent->arg, arg, sizeof(thr_arg));
+    ent->expire = to > 0? time(NULL) + to: 0;
+
+    ev = &ev_loops[arg->sock % n_loops];
+    memset(&e, 0, sizeof(e));
+    e.events = EPOLLIN | EPOLLPRI | EPOLLRDHUP;
+    e.data.ptr = ent;
+    if(ret_val = pthread_mutex_lock(&ev->mut))
+        logmsg(LOG_WARNING, "ev_park() lock: %s", strerror(ret_val));
+    ev_link(ev, ent);
+    if(epoll_ctl(ev->epfd, EPOLL_CTL_ADD, arg->sock, &e)) {
+        logmsg(LOG_WARNING, "(%lx) ev_park epoll_ctl: %s", pthread_self(), strerror(errno));
+        ev_unlink(ent);
+        free(ent);
+        ent = NULL;
+    }
+    if(ret_val = pthread_mutex_unlock(&ev->mut))
+        logmsg(LOG_WARNING, "ev_park() unlock: %s", strerror(ret_val));
+    return ent == NULL? -1: 0;
+}
+
+/*
+ * wait for events on a loop (for at most a second), hand the ready connections to the
+ * workers and drop the expired ones
+ * if mine is not NULL the first ready connection goes there instead of the work queue
+ * returns 0 if a connection was put in mine, 1 if woken up through the pipe, -1 otherwise
+ */
+static int
+ev_run(EV_LOOP *const ev, time_t *const last, thr_arg *mine)
+{
+    EV_ENT              ready, expired, *ent, *next;
+    struct epoll_event  evs[EV_BATCH];
+    time_t              now;
+    char                buf[64];
+    int                 i, n, res, ret_val;
+
+    if((n = epoll_wait(ev->epfd, evs, EV_BATCH, 1000)) < 0) {
+        if(errno != EINTR)
+            logmsg(LOG_WARNING, "epoll_wait: %s", strerror(errno));
+        n = 0;
+    }
+    ready.prev = ready.next = &ready;
+    expired.prev = expired.next = &expired;
+    now = time(NULL);
+    res = -1;
+
+    if(ret_val = pthread_mutex_lock(&ev->mut))
+        logmsg(LOG_WARNING, "thr_event() lock: %s", strerror(ret_val));
+    for(i = 0; i < n; i++) {
+        if((ent = (EV_ENT *)evs[i].data.ptr) == NULL) {
+            /* the pipe: there is work on the queue */
+            while(read(ev_pipe[0], buf, sizeof(buf)) > 0)
+                ;
+            __atomic_store_n(&ev_woken, 0, __ATOMIC_SEQ_CST);
+            res = 1;
+            continue;
+        }
+        epoll_ctl(ev->epfd, EPOLL_CTL_DEL, ent->arg.sock, NULL);
+        ev_unlink(ent);
+        ent->next = &ready;
+        ent->prev = ready.prev;
+        ready.prev->next = ent;
+        ready.prev = ent;
+    }
+    if(now != *last) {
+        /* sweep once a second */
+        *last = now;
+        for(ent = ev->head.next; ent != &ev->head; ent = next) {
+            next = ent->next;
+            if(ent->expire == 0 || ent->expire > now)
+                continue;
+            epoll_ctl(ev->epfd, EPOLL_CTL_DEL, ent->arg.sock, NULL);
+            ev_unlink(ent);
+            ent->next = &expired;
+            ent->prev = expired.prev;
+            expired.prev->next = ent;
+            expired.prev = ent;
+        }
+    }
+    if(ret_val = pthread_mutex_unlock(&ev->mut))
+        logmsg(LOG_WARNING, "thr_event() unlock: %s", strerror(ret_val));
+
+    for(ent = ready.next; ent != &ready; ent = next) {
+        next = ent->next;
+        /* the queue wait starts now, not when the client connected */
+        ent->arg.t_accept = mono_ms();
+        if(mine != NULL && res != 0) {
+            memcpy(mine, &ent->arg, sizeof(thr_arg));
+            mine->t_queued = mine->t_accept;
+            res = 0;
+        } else if((ent->arg.lstn->max_qdepth > 0 && get_thr_qlen() >= ent->arg.lstn->max_qdepth)
+        || put_thr_arg(&ent->arg))
+            shed_conn(&ent->arg);
+        free(ent);
+    }
+    for(ent = expired.next; ent != &expired; ent = next) {
+        next = ent->next;
+        drop_conn(&ent->arg, ETIMEDOUT);
+        free(ent);
+    }
+    return res;
+}
+
+/*
+ * Event thread: hand ready connections to the workers, drop the expired ones
+ */
+void *
+thr_event(void *arg)
+{
+    EV_LOOP *ev;
+    time_t  last;
+
+    ev = &ev_loops[(long)arg];
+    last = time(NULL);
+    for(;;)
+        ev_run(ev, &last, NULL);
+}
+
+/*
+ * an idle worker offers to poll the parked connections (shared mode only)
+ * returns 0 if the caller is the leader now
+ */
+int
+ev_lead(void)
+{
+    if(ev_pipe[0] < 0 || __atomic_exchange_n(&ev_leader, 1, __ATOMIC_SEQ_CST))
+        return -1;
+    return 0;
+}
+
+/*
+ * give up the lead without polling
+ */
+void
+ev_unlead(void)
+{
+    __atomic_store_n(&ev_leader, 0, __ATOMIC_SEQ_CST);
+    return;
+}
+
+/*
+ * the leader polls until it gets a connection (returns 0, with the connection in arg)
+ * or is called back to the work queue (returns 1) - either way it gives up the lead
+ */
+int
+ev_poll(thr_arg *arg)
+{
+    static time_t   last = 0;   /* only ever used by the leader */
+    int             res;
+
+    while((res = ev_run(&ev_loops[0], &last, arg)) < 0)
+        ;
+    ev_unlead();
+    return res;
+}
+
+/*
+ * work was queued but no worker is waiting for it - call the leader back (if any)
+ */
+void
+ev_wake(void)
+{
+    if(ev_pipe[1] < 0 || !__atomic_load_n(&ev_leader, __ATOMIC_SEQ_CST)
+    || __atomic_exchange_n(&ev_woken, 1, __ATOMIC_SEQ_CST))
+        return;
+    (void)write(ev_pipe[1], "", 1);
+    return;
+}
+
+#else
+
+int
+init_event(void)
+{
+    return 0;
+}
+
+int
+ev_park(thr_arg *arg, const int to)
+{
+    return -1;
+}
+
+void *
+thr_event(void *arg)
+{
+    return NULL;
+}
+
+int
+ev_lead(void)
+{
+    return -1;
+}
+
+void
+ev_unlead(void)
+{
+    return;
+}
+
+int
+ev_poll(thr_arg *arg)
+{
+    return 1;
+}
+
+void
+ev_wake(void)
+{
+    return;
+}
+
+#endif
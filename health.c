@@ -0,0 +1,556 @@
+/*
+ * Pound - the reverse-proxy load-balancer
+ * Copyright (C) 2002-2010 Apsis GmbH
+ *
+ * This file is part of Pound.
+ *
+ * Pound is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact information:
+ * Apsis GmbH
+ * P.O.Box
+ * 8707 Uetikon am See
+ * Switzerland
+ * EMail: roseg@apsis.ch
+ */
+
+/*
+ * Back-end health checks
+ *
+ * A single thread probes all the back-ends at the same time: a probe is a
+ * non-blocking connection watched in one epoll set (poll without epoll), so a
+ * back-end that does not answer holds up nobody but itself.
+ *
+ * Without a HealthCheck block the probe is a connect(): alive back-ends with an
+ * HAport are checked on it and killed if it does not answer; dead back-ends are
+ * checked on their HAport (or their address) and resurrected as soon as it does.
+ *
+ * With a HealthCheck block the probe is an HTTP request to the back-end (over
+ * TLS for HTTPS back-ends): the response must come within MaxLatency, with the
+ * expected status and a body matching the pattern. Fall failures in a row kill
+ * an alive back-end, Rise successes in a row resurrect a dead one.
+ *
+ * Every back-end is probed at its own interval (Alive), give or take 10%, so
+ * the probes do not all go out together.
+ */
+
+#include    "pound.h"
+
+#define HC_RESP     16384       /* max. response kept for a health check */
+
+typedef enum { HC_CONNECT, HC_HANDSHAKE, HC_SEND, HC_RECV } HC_STATE;
+
+/* the health-check state of one back-end */
+typedef struct {
+    SERVICE         *svc;
+    BACKEND         *be;
+    int             fd;         /* probe in progress (-1: none) */
+    SSL             *ssl;       /* ... to an HTTPS back-end */
+    HC_STATE        state;
+    int             events;     /* what it waits for (POLLIN/POLLOUT, 0: not watched yet) */
+    int             kill;       /* connect only: the back-end was alive, a failed probe kills it */
+    char            *req;       /* HTTP check: the request */
+    int             req_len, sent;
+    char            *resp;      /* ... and the response so far */
+    int             resp_len;
+    int             alive;      /* back-end state the rise/fall counts refer to */
+    int             n_ok, n_fail;   /* HTTP checks in a row that worked/failed */
+    unsigned long   start;      /* when the probe in progress started (msec, monotonic) */
+    unsigned long   due;        /* time of the next probe */
+    unsigned long   deadline;   /* ... or when to give up on the one in progress */
+}   PROBE;
+
+static PROBE        *probes = NULL;
+static int          n_probes = 0;
+static unsigned int hc_seed;
+
+#if HAVE_SYS_EPOLL_H
+#define HC_BATCH    64          /* max. events handled per epoll_wait */
+
+static int          hc_epfd = -1;
+#else
+static struct pollfd    *hc_polls = NULL;
+static PROBE            **hc_polled = NULL;
+#endif
+
+/*
+ * the interval to the next probe: Alive seconds, +/- 10%
+ */
+static unsigned long
+hc_interval(const BACKEND *be)
+{
+    unsigned long   ms;
+
+    ms = be->alive_to * 1000UL;
+    return ms - ms / 10 + rand_r(&hc_seed) % (ms / 5 + 1);
+}
+
+/*
+ * the Host of a check that sets none: the back-end address and port, with
+ * IPv6 addresses in brackets; a UNIX socket has no address a server would
+ * know itself by, so localhost
+ */
+static void
+hc_host(char *const res, const int res_len, const BACKEND *be)
+{
+    char    buf[INET6_ADDRSTRLEN];
+
+    switch(be->addr.ai_family) {
+    case AF_INET6:
+        addr2str(buf, sizeof(buf), &be->addr, 1);
+        snprintf(res, res_len, "[%s]:%d", buf, ntohs(((struct sockaddr_in6 *)be->addr.ai_addr)->sin6_port));
+        break;
+    case AF_UNIX:
+        snprintf(res, res_len, "localhost");
+        break;
+    default:
+        str_be(res, res_len, be);
+        break;
+    }
+    return;
+}
+
+static void
+hc_add(SERVICE *const svc)
+{
+    BACKEND         *be;
+    PROBE           *p;
+    char            addr[MAXBUF];
+    unsigned long   now;
+    int             has_host;
+
+    now = mono_ms();
+    for(be = svc->backends; be; be = be->next) {
+        if(be->be_type)
+            continue;
+        if((p = (PROBE *)realloc(probes, (n_probes + 1) * sizeof(PROBE))) == NULL) {
+            logmsg(LOG_WARNING, "health check: out of memory");
+            return;
+        }
+        probes = p;
+        p = &probes[n_probes++];
+        memset(p, 0, sizeof(PROBE));
+        p->svc = svc;
+        p->be = be;
+        p->fd = -1;
+        p->alive = be->alive;
+        if(be->health == NULL) {
+            /* spread the first round over one interval */
+            p->due = now + rand_r(&hc_seed) % (be->alive_to * 1000UL + 1);
+            continue;
+        }
+        /* HTTP checks start right away, to find failing back-ends before the clients do */
+        p->due = now;
+        hc_host(addr, MAXBUF - 1, be);
+        has_host = be->health->has_host;
+        if((p->req = (char *)malloc(strlen(be->health->req) + strlen(addr) + 32)) == NULL
+        || (p->resp = (char *)malloc(HC_RESP + 1)) == NULL) {
+            logmsg(LOG_WARNING, "health check: out of memory");
+            n_probes--;
+            return;
+        }
+        p->req_len = sprintf(p->req, "%s%s%s%sConnection: close\r\n\r\n", be->health->req,
+            has_host? "": "Host: ", has_host? "": addr, has_host? "": "\r\n");
+    }
+    return;
+}
+
+/*
+ * wait for the probe socket to become readable/writeable
+ */
+static int
+hc_watch(PROBE *const p, const int events)
+{
+#if HAVE_SYS_EPOLL_H
+    struct epoll_event  ev;
+
+    if(p->events == events)
+        return 0;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = ((events & POLLIN)? EPOLLIN: 0) | ((events & POLLOUT)? EPOLLOUT: 0);
+    ev.data.ptr = p;
+    if(epoll_ctl(hc_epfd, p->events? EPOLL_CTL_MOD: EPOLL_CTL_ADD, p->fd, &ev)) {
+        logmsg(LOG_WARNING, "health check: epoll_ctl: %s", strerror(errno));
+        return -1;
+    }
+#endif
+    p->events = events;
+    return 0;
+}
+
+static void
+hc_close(PROBE *const p)
+{
+    if(p->ssl != NULL) {
+        /* a close without shutdown makes the session non-resumable - for the clients too */
+        if(SSL_is_init_finished(p->ssl))
+            (void)SSL_shutdown(p->ssl);
+        SSL_free(p->ssl);
+        p->ssl = NULL;
+    }
+    if(p->fd >= 0) {
+#if HAVE_SYS_EPOLL_H
+        if(p->events)
+            epoll_ctl(hc_epfd, EPOLL_CTL_DEL, p->fd, NULL);
+#endif
+        shutdown(p->fd, 2);
+        close(p->fd);
+        p->fd = -1;
+    }
+    p->events = 0;
+    return;
+}
+
+/*
+ * a probe is over (why: NULL if it worked, otherwise what went wrong):
+ * apply the result and schedule the next one
+ */
+static void
+hc_done(PROBE *const p, const char *why, const unsigned long now)
+{
+    BACKEND *be;
+    HEALTH  *hc;
+    char    buf[MAXBUF];
+
+    hc_close(p);
+    be = p->be;
+    if((hc = be->health) == NULL) {
+        if(p->kill && why != NULL) {
+            kill_be(p->svc, be, BE_KILL);
+            str_be(buf, MAXBUF - 1, be);
+            logmsg(LOG_NOTICE, "BackEnd %s is dead (HA)", buf);
+        } else if(!p->kill && why == NULL)
+            kill_be(p->svc, be, BE_RESURRECT);
+    } else {
+        if(p->alive != be->alive) {
+            /* killed or resurrected since: count again */
+            p->alive = be->alive;
+            p->n_ok = p->n_fail = 0;
+        }
+        if(why == NULL) {
+            p->n_ok++;
+            p->n_fail = 0;
+        } else {
+            p->n_fail++;
+            p->n_ok = 0;
+        }
+        if(be->alive && p->n_fail >= hc->fall) {
+            kill_be(p->svc, be, BE_KILL);
+            str_be(buf, MAXBUF - 1, be);
+            logmsg(LOG_NOTICE, "BackEnd %s is dead (health check: %s)", buf, why);
+        } else if(!be->alive && p->n_ok >= hc->rise)
+            kill_be(p->svc, be, BE_RESURRECT);
+    }
+    p->due = now + hc_interval(be);
+    return;
+}
+
+/*
+ * no verdict (a problem on our side) - try again later
+ */
+static void
+hc_retry(PROBE *const p, const unsigned long now)
+{
+    hc_close(p);
+    p->due = now + hc_interval(p->be);
+    return;
+}
+
+/*
+ * an I/O call did not complete: wait for what it needs (0) or give up (-1)
+ */
+static int
+hc_want(PROBE *const p, const int res, const int events)
+{
+    if(p->ssl != NULL)
+        switch(SSL_get_error(p->ssl, res)) {
+        case SSL_ERROR_WANT_READ:
+            return hc_watch(p, POLLIN);
+        case SSL_ERROR_WANT_WRITE:
+            return hc_watch(p, POLLOUT);
+        default:
+            return -1;
+        }
+    if(res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return hc_watch(p, events);
+    return -1;
+}
+
+/*
+ * is the response complete? (Content-Length, should the back-end not close the connection)
+ */
+static int
+hc_complete(const PROBE *p)
+{
+    const char  *body, *h;
+
+    if((body = strstr(p->resp, "\r\n\r\n")) == NULL)
+        return 0;
+    for(h = strchr(p->resp, '\n'); h != NULL && h < body; h = strchr(h, '\n'))
+        if(!strncasecmp(++h, "Content-Length:", 15))
+            return p->resp_len - (body + 4 - p->resp) >= atol(h + 15);
+    return 0;
+}
+
+/*
+ * check the response - returns what is wrong with it, NULL if nothing
+ */
+static const char *
+hc_check(const PROBE *p)
+{
+    HEALTH      *hc;
+    const char  *body;
+    int         status;
+
+    hc = p->be->health;
+    if(p->resp_len < 12 || strncmp(p->resp, "HTTP/1.", 7) || !isdigit(p->resp[9]))
+        return "bad response";
+    status = atoi(p->resp + 9);
+    if(hc->status? status != hc->status: (status < 200 || status >= 400))
+        return "bad status";
+    if(hc->has_body && ((body = strstr(p->resp, "\r\n\r\n")) == NULL || regexec(&hc->body, body + 4, 0, NULL, 0)))
+        return "body does not match";
+    return NULL;
+}
+
+/*
+ * move the probe along as far as it goes without blocking
+ */
+static void
+hc_step(PROBE *const p, const unsigned long now)
+{
+    BACKEND     *be;
+    const char  *why;
+    int         res, error;
+    socklen_t   len;
+
+    be = p->be;
+    for(;;)
+        switch(p->state) {
+        case HC_CONNECT:
+            len = sizeof(error);
+            if(getsockopt(p->fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0) {
+                hc_done(p, "connect failed", now);
+                return;
+            }
+            if(be->health == NULL) {
+                hc_done(p, NULL, now);
+                return;
+            }
+            if(be->ctx != NULL) {
+                if((p->ssl = SSL_new(be->ctx)) == NULL || !SSL_set_fd(p->ssl, p->fd)) {
+                    hc_retry(p, now);
+                    return;
+                }
+                be_resume(be, p->ssl);
+                p->state = HC_HANDSHAKE;
+            } else
+                p->state = HC_SEND;
+            p->sent = 0;
+            break;
+        case HC_HANDSHAKE:
+            if((res = SSL_connect(p->ssl)) != 1) {
+                if(hc_want(p, res, POLLOUT))
+                    hc_done(p, "TLS handshake failed", now);
+                return;
+            }
+            p->state = HC_SEND;
+            break;
+        case HC_SEND:
+            while(p->sent < p->req_len) {
+                if(p->ssl != NULL)
+                    res = SSL_write(p->ssl, p->req + p->sent, p->req_len - p->sent);
+                else
+                    res = write(p->fd, p->req + p->sent, p->req_len - p->sent);
+                if(res <= 0) {
+                    if(hc_want(p, res, POLLOUT))
+                        hc_done(p, "send failed", now);
+                    return;
+                }
+                p->sent += res;
+            }
+            p->state = HC_RECV;
+            p->resp_len = 0;
+            p->resp[0] = '\0';
+            break;
+        case HC_RECV:
+            while(p->resp_len < HC_RESP && !hc_complete(p)) {
+                if(p->ssl != NULL)
+                    res = SSL_read(p->ssl, p->resp + p->resp_len, HC_RESP - p->resp_len);
+                else
+                    res = read(p->fd, p->resp + p->resp_len, HC_RESP - p->resp_len);
+                if(res <= 0) {
+                    if(!hc_want(p, res, POLLIN))
+                        return;
+                    /* EOF (or an error): check what came */
+                    break;
+                }
+                p->resp_len += res;
+                p->resp[p->resp_len] = '\0';
+            }
+            if(be->health->max_lat > 0 && now - p->start > be->health->max_lat)
+                why = "too slow";
+            else
+                why = hc_check(p);
+            hc_done(p, why, now);
+            return;
+        }
+}
+
+/*
+ * start a probe
+ */
+static void
+hc_start(PROBE *const p, const unsigned long now)
+{
+    BACKEND         *be;
+    struct addrinfo z_addr, *addr;
+    int             has_ha, flags;
+
+    be = p->be;
+    memset(&z_addr, 0, sizeof(z_addr));
+    has_ha = memcmp(&be->ha_addr, &z_addr, sizeof(z_addr)) != 0;
+    if(be->health != NULL) {
+        /* HTTP check: always on the back-end itself */
+        addr = &be->addr;
+        p->deadline = now + (be->health->max_lat > 0? be->health->max_lat: (be->conn_to + be->to) * 1000UL);
+    } else if((p->kill = be->alive) != 0 && !has_ha) {
+        /* nothing to check */
+        p->due = now + hc_interval(be);
+        return;
+    } else {
+        addr = has_ha? &be->ha_addr: &be->addr;
+        p->deadline = now + be->conn_to * 1000UL;
+    }
+    switch(addr->ai_family) {
+    case AF_INET:
+        p->fd = socket(PF_INET, SOCK_STREAM, 0);
+        break;
+    case AF_INET6:
+        p->fd = socket(PF_INET6, SOCK_STREAM, 0);
+        break;
+    case AF_UNIX:
+        p->fd = socket(PF_UNIX, SOCK_STREAM, 0);
+        break;
+    default:
+        p->fd = -1;
+        break;
+    }
+    if(p->fd < 0) {
+        p->due = now + hc_interval(be);
+        return;
+    }
+    if((flags = fcntl(p->fd, F_GETFL, 0)) < 0 || fcntl(p->fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        hc_retry(p, now);
+        return;
+    }
+    p->start = now;
+    p->state = HC_CONNECT;
+    if(connect(p->fd, addr->ai_addr, addr->ai_addrlen) == 0)
+        /* connected immediately (usually localhost) */
+        hc_step(p, now);
+    else if(errno != EINPROGRESS)
+        hc_done(p, "connect failed", now);
+    else if(hc_watch(p, POLLOUT))
+        hc_retry(p, now);
+    return;
+}
+
+/*
+ * wait up to to_wait msec for probes in progress to move
+ */
+static void
+hc_wait(const int to_wait)
+{
+#if HAVE_SYS_EPOLL_H
+    struct epoll_event  ev[HC_BATCH];
+    int                 i, n;
+
+    if((n = epoll_wait(hc_epfd, ev, HC_BATCH, to_wait)) < 0) {
+        if(errno != EINTR)
+            logmsg(LOG_WARNING, "health check: epoll_wait: %s", strerror(errno));
+        return;
+    }
+    for(i = 0; i < n; i++)
+        hc_step((PROBE *)ev[i].data.ptr, mono_ms());
+#else
+    int     i, n;
+
+    for(n = i = 0; i < n_probes; i++)
+        if(probes[i].fd >= 0 && probes[i].events) {
+            hc_polls[n].fd = probes[i].fd;
+            hc_polls[n].events = probes[i].events;
+            hc_polls[n].revents = 0;
+            hc_polled[n++] = &probes[i];
+        }
+    if(poll(hc_polls, n, to_wait) <= 0)
+        return;
+    for(i = 0; i < n; i++)
+        if(hc_polls[i].revents)
+            hc_step(hc_polled[i], mono_ms());
+#endif
+    return;
+}
+
+/*
+ * health-check thread: runs the probes that are due, waits for those in progress
+ */
+void *
+thr_health(void *arg)
+{
+    LISTENER        *lstn;
+    SERVICE         *svc;
+    PROBE           *p;
+    unsigned long   now, next;
+    int             i;
+
+    hc_seed = (unsigned int)time(NULL) ^ (unsigned int)getpid();
+    for(lstn = listeners; lstn; lstn = lstn->next)
+        for(svc = lstn->services; svc; svc = svc->next)
+            hc_add(svc);
+    for(svc = services; svc; svc = svc->next)
+        hc_add(svc);
+    if(n_probes == 0)
+        return NULL;
+#if HAVE_SYS_EPOLL_H
+    if((hc_epfd = epoll_create(n_probes)) < 0) {
+        logmsg(LOG_ERR, "health check: epoll_create: %s - no health checks", strerror(errno));
+        return NULL;
+    }
+#else
+    if((hc_polls = (struct pollfd *)calloc(n_probes, sizeof(struct pollfd))) == NULL
+    || (hc_polled = (PROBE **)calloc(n_probes, sizeof(PROBE *))) == NULL) {
+        logmsg(LOG_ERR, "health check: out of memory - no health checks");
+        return NULL;
+    }
+#endif
+
+    for(;;) {
+        now = mono_ms();
+        next = now + 1000;
+        for(i = 0; i < n_probes; i++) {
+            p = &probes[i];
+            if(p->fd >= 0 && now >= p->deadline)
+                hc_done(p, (p->be->health != NULL && p->be->health->max_lat > 0)? "too slow": "timed out", now);
+            if(p->fd < 0 && now >= p->due)
+                hc_start(p, now);
+            if(p->fd >= 0) {
+                if(p->deadline < next)
+                    next = p->deadline;
+            } else if(p->due < next)
+                next = p->due;
+        }
+        hc_wait(next > now? (int)(next - now): 0);
+    }
+}
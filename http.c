@@ -90,27 +90,287 @@ redirect_reply(BIO *const c, const char *url, const int code)
     return;
 }
 
+static int  err_to = -1;
+
+typedef struct {
+    int         timeout;
+    RENEG_STATE *reneg_state;
+} BIO_ARG;
+
 /*
- * Read and write some binary data
+ * Copy cont bytes from cl to be, straight out of the input buffer where cl is a line buffer
+ * with stream set whatever was copied is flushed before waiting for more input
+ * the output is not flushed otherwise
  */
 static int
-copy_bin(BIO *const cl, BIO *const be, LONG cont, LONG *res_bytes, const int no_write)
+copy_data(BIO *const cl, BIO *const be, LONG cont, LONG *res_bytes, const int no_write, const int stream)
 {
     char        buf[MAXBUF];
+    const char  *data;
     int         res;
 
     while(cont > L0) {
-        if((res = BIO_read(cl, buf, cont > MAXBUF? MAXBUF: cont)) < 0)
+        if(stream && !no_write && BIO_pending(cl) <= 0 && BIO_flush(be) != 1)
+            return -4;
+        if((res = lb_peek(cl, &data)) == -2) {
+            if((res = BIO_read(cl, buf, cont > MAXBUF? MAXBUF: cont)) > 0)
+                data = buf;
+        } else if(res > cont)
+            res = cont;
+        if(res < 0)
             return -1;
         else if(res == 0)
             return -2;
         if(!no_write)
-            if(BIO_write(be, buf, res) != res)
+            if(BIO_write(be, data, res) != res)
                 return -3;
+        if(data != buf)
+            lb_consume(cl, res);
         cont -= res;
         if(res_bytes)
             *res_bytes += res;
     }
+    return 0;
+}
+
+/*
+ * the socket under a plaintext line buffer and its time-out (msec, -1 for none), -1 if there is none
+ */
+static int
+relay_fd(BIO *const bio, int *const to)
+{
+    BIO     *sock;
+    BIO_ARG *ba;
+    int     fd;
+
+    if(BIO_method_type(bio) == BIO_TYPE_SOCKET)
+        sock = bio;
+    else if((sock = BIO_next(bio)) == NULL || BIO_method_type(sock) != BIO_TYPE_SOCKET)
+        return -1;
+    if((ba = (BIO_ARG *)BIO_get_callback_arg(sock)) != NULL && ba->timeout < 0)
+        /* timed out before - let the BIO report it */
+        return -1;
+    *to = (ba == NULL || ba->timeout == 0)? -1: ba->timeout * 1000;
+    if(BIO_get_fd(sock, &fd) < 0)
+        return -1;
+    return fd;
+}
+
+/*
+ * wait for fd to become ready, as bio_callback() does
+ */
+static int
+relay_wait(const int fd, const short events, const int to)
+{
+    struct pollfd   p;
+
+    for(;;) {
+        memset(&p, 0, sizeof(p));
+        p.fd = fd;
+        p.events = events;
+        switch(poll(&p, 1, to)) {
+        case 1:
+            if(p.revents & (events | POLLHUP))
+                return 0;
+            errno = (events & POLLIN)? EIO: ECONNRESET;
+            return -1;
+        case 0:
+            errno = ETIMEDOUT;
+            return -1;
+        default:
+            if(errno != EINTR)
+                return -1;
+        }
+    }
+}
+
+#if HAVE_SPLICE
+/*
+ * splice() relay for plaintext connections: the data moves from socket to socket through
+ * a pipe (one per thread, made on first use) without being copied to user space
+ */
+#define RELAY_MAX   (64 * 1024)     /* default pipe capacity */
+
+static pthread_key_t    relay_key;
+static pthread_once_t   relay_once = PTHREAD_ONCE_INIT;
+
+static void
+relay_free(void *arg)
+{
+    int *fds = (int *)arg;
+
+    close(fds[0]);
+    close(fds[1]);
+    free(fds);
+}
+
+static void
+relay_init(void)
+{
+    if(pthread_key_create(&relay_key, relay_free))
+        logmsg(LOG_WARNING, "relay_init: pthread_key_create failed");
+}
+
+/*
+ * the pipe of this thread - NULL if it can't be had
+ */
+static int *
+relay_pipe(void)
+{
+    int *fds;
+
+    pthread_once(&relay_once, relay_init);
+    if((fds = (int *)pthread_getspecific(relay_key)) != NULL)
+        return fds;
+    if((fds = (int *)malloc(2 * sizeof(int))) == NULL)
+        return NULL;
+    if(pipe2(fds, O_NONBLOCK | O_CLOEXEC)) {
+        logmsg(LOG_WARNING, "(%lx) relay pipe: %s", pthread_self(), strerror(errno));
+        free(fds);
+        return NULL;
+    }
+    if(pthread_setspecific(relay_key, fds)) {
+        relay_free(fds);
+        return NULL;
+    }
+    return fds;
+}
+
+/*
+ * drop the pipe of this thread (it may still hold data after an error)
+ */
+static void
+relay_drop(int *fds)
+{
+    pthread_setspecific(relay_key, NULL);
+    relay_free(fds);
+}
+
+/*
+ * Relay cont bytes (cont < 0: until EOF) from in to out with splice() if both are plain sockets
+ * whatever is already buffered in in goes first
+ * returns 1 if not applicable, otherwise as copy_bin()
+ */
+static int
+splice_bin(BIO *const in, BIO *const out, LONG cont, LONG *res_bytes)
+{
+    int     *fds, in_fd, out_fd, in_to, out_to, n, res, done;
+    LONG    pend;
+
+    if((in_fd = relay_fd(in, &in_to)) < 0 || (out_fd = relay_fd(out, &out_to)) < 0 || (fds = relay_pipe()) == NULL)
+        return 1;
+    while(cont != L0 && (pend = BIO_pending(in)) > 0)
+        if(res = copy_data(in, out, (cont > L0 && cont < pend)? cont: pend, res_bytes, 0, 0))
+            return res;
+        else if(cont > L0)
+            cont -= (cont < pend)? cont: pend;
+    if(BIO_flush(out) != 1)
+        return -4;
+    while(cont != L0) {
+        n = (cont < L0 || cont > RELAY_MAX)? RELAY_MAX: cont;
+        if(relay_wait(in_fd, POLLIN | POLLPRI, in_to))
+            return -1;
+        if((res = splice(in_fd, NULL, fds[1], NULL, n, SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) < 0) {
+            if(errno == EAGAIN || errno == EINTR)
+                continue;
+            return -1;
+        } else if(res == 0)
+            /* EOF */
+            return cont < L0? 0: -2;
+        if(cont > L0)
+            cont -= res;
+        for(done = 0; done < res; done += n) {
+            if(relay_wait(out_fd, POLLOUT, out_to)) {
+                relay_drop(fds);
+                return -3;
+            }
+            if((n = splice(fds[0], NULL, out_fd, NULL, res - done,
+                SPLICE_F_MOVE | SPLICE_F_NONBLOCK | (cont != L0? SPLICE_F_MORE: 0))) < 0) {
+                if(errno == EAGAIN || errno == EINTR) {
+                    n = 0;
+                    continue;
+                }
+                relay_drop(fds);
+                return -3;
+            }
+        }
+        if(res_bytes)
+            *res_bytes += res;
+    }
+    return 0;
+}
+#else
+static int
+splice_bin(BIO *const in, BIO *const out, LONG cont, LONG *res_bytes)
+{
+    return 1;
+}
+#endif
+
+/*
+ * Write a block of tot bytes given as n pieces (the outgoing request headers)
+ * a small block goes to the output buffer and leaves with whatever follows; a larger one
+ * goes out in a single writev() on a plain socket, otherwise in a single write
+ */
+static int
+send_iov(BIO *const be, struct iovec *iov, const int n, const int tot)
+{
+    char    *buf;
+    int     i, fd, to, res;
+
+#if HAVE_SYS_UIO_H
+#ifndef IOV_MAX
+#define IOV_MAX 16
+#endif
+    if(tot >= MAXBUF && (fd = relay_fd(be, &to)) >= 0) {
+        if(BIO_flush(be) != 1)
+            return -1;
+        for(i = 0; i < n; ) {
+            if(relay_wait(fd, POLLOUT, to))
+                return -1;
+            if((res = writev(fd, iov + i, (n - i > IOV_MAX)? IOV_MAX: n - i)) < 0) {
+                if(errno == EAGAIN || errno == EINTR)
+                    continue;
+                return -1;
+            }
+            for(; i < n && res >= iov[i].iov_len; i++)
+                res -= iov[i].iov_len;
+            if(i < n) {
+                iov[i].iov_base = (char *)iov[i].iov_base + res;
+                iov[i].iov_len -= res;
+            }
+        }
+        return 0;
+    }
+#endif
+    if(tot < MAXBUF) {
+        for(i = 0; i < n; i++)
+            if(BIO_write(be, iov[i].iov_base, iov[i].iov_len) != iov[i].iov_len)
+                return -1;
+        return 0;
+    }
+    if((buf = (char *)malloc(tot)) == NULL)
+        return -1;
+    for(res = i = 0; i < n; res += iov[i++].iov_len)
+        memcpy(buf + res, iov[i].iov_base, iov[i].iov_len);
+    res = BIO_write(be, buf, tot);
+    free(buf);
+    return (res == tot)? 0: -1;
+}
+
+/*
+ * Read and write some binary data
+ */
+static int
+copy_bin(BIO *const cl, BIO *const be, LONG cont, LONG *res_bytes, const int no_write)
+{
+    int res;
+
+    /* large bodies between plain sockets need not pass through here at all */
+    if(!no_write && cont > MAXBUF && (res = splice_bin(cl, be, cont, res_bytes)) <= 0)
+        return res;
+    if(res = copy_data(cl, be, cont, res_bytes, no_write, 0))
+        return res;
     if(!no_write)
         if(BIO_flush(be) != 1)
             return -4;
@@ -128,6 +388,10 @@ get_line(BIO *const in, char *const buf, const int bufsize)
     char    tmp;
     int     i, seen_cr;
 
+    /* client and back-end connections: scan the buffer directly */
+    if((i = lb_get_line(in, buf, bufsize)) >= 0)
+        return i;
+
     memset(buf, 0, bufsize);
     for(i = 0, seen_cr = 0; i < bufsize - 1; i++)
         switch(BIO_read(in, &tmp, 1)) {
@@ -198,33 +462,65 @@ strip_eol(char *lin)
     return 0;
 }
 
+/*
+ * Parse a chunk header: the size in hex, possibly followed by extensions
+ * returns the number of digits (0: not a chunk header), the size in the arg
+ */
+static int
+chunk_size(const char *lin, LONG *const size)
+{
+    const char  *p;
+    LONG        cont;
+    int         d;
+
+    /* "0x" as taken by strtol */
+    p = (lin[0] == '0' && (lin[1] | 0x20) == 'x' && isxdigit(lin[2]))? lin + 2: lin;
+    for(cont = L0; ; p++) {
+        if(*p >= '0' && *p <= '9')
+            d = *p - '0';
+        else if((*p | 0x20) >= 'a' && (*p | 0x20) <= 'f')
+            d = (*p | 0x20) - 'a' + 10;
+        else
+            break;
+        /* saturate, as strtol does */
+        cont = (cont > (LONG)(~(unsigned LONG)0 >> 5))? (LONG)(~(unsigned LONG)0 >> 1): cont * 16 + d;
+    }
+    *size = cont;
+    return p - lin;
+}
+
 /*
  * Copy chunked
+ * the chunk headers and data are gathered in the output buffer, which is flushed at the end
+ * of the message and whenever we are about to wait for more input (so streamed content
+ * still goes out as soon as it arrives)
  */
 static int
 copy_chunks(BIO *const cl, BIO *const be, LONG *res_bytes, const int no_write, const LONG max_size)
 {
     char        buf[MAXBUF];
     LONG        cont, tot_size;
-    regmatch_t  matches[2];
-    int         res;
+    int         res, len;
 
     for(tot_size = 0L;;) {
+        if(!no_write && BIO_pending(cl) <= 0 && BIO_flush(be) != 1) {
+            logmsg(LOG_NOTICE, "(%lx) copy_chunks flush error: %s", pthread_self(), strerror(errno));
+            return -4;
+        }
         if((res = get_line(cl, buf, MAXBUF)) < 0) {
             logmsg(LOG_NOTICE, "(%lx) chunked read error: %s", pthread_self(), strerror(errno));
             return -1;
         } else if(res > 0)
             /* EOF */
             return 0;
-        if(!regexec(&CHUNK_HEAD, buf, 2, matches, 0))
-            cont = STRTOL(buf, NULL, 16);
-        else {
+        if(chunk_size(buf, &cont) == 0) {
             /* not chunk header */
             logmsg(LOG_NOTICE, "(%lx) bad chunk header <%s>: %s", pthread_self(), buf, strerror(errno));
             return -2;
         }
+        len = strlen(buf);
         if(!no_write)
-            if(BIO_printf(be, "%s\r\n", buf) <= 0) {
+            if(BIO_write(be, buf, len) != len || BIO_write(be, "\r\n", 2) != 2) {
                 logmsg(LOG_NOTICE, "(%lx) error write chunked: %s", pthread_self(), strerror(errno));
                 return -3;
             }
@@ -236,7 +532,7 @@ copy_chunks(BIO *const cl, BIO *const be, LONG *res_bytes, const int no_write, c
         }
 
         if(cont > L0) {
-            if(copy_bin(cl, be, cont, res_bytes, no_write)) {
+            if(copy_data(cl, be, cont, res_bytes, no_write, 1)) {
                 if(errno)
                     logmsg(LOG_NOTICE, "(%lx) error copy chunk cont: %s", pthread_self(), strerror(errno));
                 return -4;
@@ -253,21 +549,27 @@ copy_chunks(BIO *const cl, BIO *const be, LONG *res_bytes, const int no_write, c
         }
         if(buf[0])
             logmsg(LOG_NOTICE, "(%lx) unexpected after chunk \"%s\"", pthread_self(), buf);
+        len = strlen(buf);
         if(!no_write)
-            if(BIO_printf(be, "%s\r\n", buf) <= 0) {
+            if(BIO_write(be, buf, len) != len || BIO_write(be, "\r\n", 2) != 2) {
                 logmsg(LOG_NOTICE, "(%lx) error after chunk write: %s", pthread_self(), strerror(errno));
                 return -6;
             }
     }
     /* possibly trailing headers */
     for(;;) {
+        if(!no_write && BIO_pending(cl) <= 0 && BIO_flush(be) != 1) {
+            logmsg(LOG_NOTICE, "(%lx) copy_chunks flush error: %s", pthread_self(), strerror(errno));
+            return -4;
+        }
         if((res = get_line(cl, buf, MAXBUF)) < 0) {
             logmsg(LOG_NOTICE, "(%lx) error post-chunk: %s", pthread_self(), strerror(errno));
             return -7;
         } else if(res > 0)
             break;
+        len = strlen(buf);
         if(!no_write)
-            if(BIO_printf(be, "%s\r\n", buf) <= 0) {
+            if(BIO_write(be, buf, len) != len || BIO_write(be, "\r\n", 2) != 2) {
                 logmsg(LOG_NOTICE, "(%lx) error post-chunk write: %s", pthread_self(), strerror(errno));
                 return -8;
             }
@@ -282,12 +584,90 @@ copy_chunks(BIO *const cl, BIO *const be, LONG *res_bytes, const int no_write, c
     return 0;
 }
 
-static int  err_to = -1;
-
+/*
+ * one direction of a relay
+ */
 typedef struct {
-    int         timeout;
-    RENEG_STATE *reneg_state;
-} BIO_ARG;
+    BIO         *in, *out;
+    const char  *what;          /* for the log */
+    LONG        *bytes;         /* the bytes moved are added here (may be NULL) */
+    LONG        max;            /* moving more than that is an error (L_1: no limit) */
+    LONG        done;
+}   PUMP;
+
+/*
+ * move whatever the input has (one read at most) to the output
+ * returns the number of bytes moved, 0 on EOF or read error, -1 on write error or if max was exceeded
+ */
+static int
+pump_move(PUMP *const p)
+{
+    char        buf[MAXBUF];
+    const char  *data;
+    int         res;
+
+    if((res = lb_peek(p->in, &data)) == -2 && (res = BIO_read(p->in, buf, MAXBUF)) > 0)
+        data = buf;
+    if(res <= 0)
+        return 0;
+    if(p->max >= L0 && (p->done += res) > p->max) {
+        logmsg(LOG_NOTICE, "(%lx) error copy %s: max. RPC length exceeded", pthread_self(), p->what);
+        return -1;
+    }
+    if(BIO_write(p->out, data, res) != res) {
+        if(errno)
+            logmsg(LOG_NOTICE, "(%lx) error copy %s: %s", pthread_self(), p->what, strerror(errno));
+        return -1;
+    }
+    if(data != buf)
+        lb_consume(p->in, res);
+    if(p->bytes)
+        *p->bytes += res;
+    /* RelayFlush 0: only once there is nothing more to copy */
+    if((relay_flush || BIO_pending(p->in) <= 0) && BIO_flush(p->out) != 1) {
+        if(errno)
+            logmsg(LOG_NOTICE, "(%lx) error flush %s: %s", pthread_self(), p->what, strerror(errno));
+        return -1;
+    }
+    return res;
+}
+
+/*
+ * Relay data until EOF in one (n == 1) or both (n == 2) directions
+ * a single direction relies on the BIO time-outs, both directions end after to msec without data
+ * returns 0 when done, -1 on error (already logged)
+ */
+static int
+pump(PUMP *const p, const int n, const int to)
+{
+    struct pollfd   fds[2];
+    int             i, res;
+
+    if(n == 1) {
+        while((res = pump_move(p)) > 0)
+            ;
+        return res;
+    }
+    memset(fds, 0, sizeof(fds));
+    for(i = 0; i < n; i++) {
+        BIO_get_fd(p[i].in, &fds[i].fd);
+        fds[i].events = POLLIN | POLLPRI;
+    }
+    for(;;) {
+        /* buffered input first, otherwise wait for some */
+        for(res = i = 0; i < n; i++)
+            if(BIO_pending(p[i].in) > 0) {
+                fds[i].revents = POLLIN;
+                res++;
+            } else
+                fds[i].revents = 0;
+        if(res == 0 && poll(fds, n, to) <= 0)
+            return 0;
+        for(i = 0; i < n; i++)
+            if(fds[i].revents && (res = pump_move(&p[i])) <= 0)
+                return res;
+    }
+}
 
 /*
  * Time-out for client read/gets
@@ -398,75 +778,262 @@ is_readable(BIO *const bio, const int to_wait)
     return (poll(&p, 1, to_wait * 1000) > 0);
 }
 
+/*
+ * A back-end connection: the BIO chain plus the time-out state its callback uses,
+ * so that it can pass from one worker to another through the back-end pool
+ */
+struct _be_conn {
+    BIO                 *bio;       /* line buffer on top of the socket (or SSL) BIO */
+    BIO_ARG             ba;
+    int                 n_req;      /* requests sent on this connection */
+    time_t              last;       /* when it was put in the pool */
+    BE_CONN             *next;
+};
+
+static void
+be_free(BE_CONN *const bc)
+{
+    if(bc->bio != NULL) {
+        BIO_reset(bc->bio);
+        BIO_free_all(bc->bio);
+    }
+    free(bc);
+    return;
+}
+
+/*
+ * take an idle connection from the back-end pool (if any)
+ * connections idle for too long or readable (closed by the back-end) are dropped
+ */
+static BE_CONN *
+be_get(BACKEND *const be)
+{
+    BE_CONN *bc;
+    time_t  now;
+    int     ret_val;
+
+    for(now = time(NULL);;) {
+        if(ret_val = pthread_mutex_lock(&be->mut)) {
+            logmsg(LOG_WARNING, "be_get() lock: %s", strerror(ret_val));
+            return NULL;
+        }
+        if((bc = be->pool) != NULL) {
+            be->pool = bc->next;
+            be->n_pool--;
+        }
+        if(ret_val = pthread_mutex_unlock(&be->mut))
+            logmsg(LOG_WARNING, "be_get() unlock: %s", strerror(ret_val));
+        if(bc == NULL)
+            return NULL;
+        if(now - bc->last < be->pool_to && !is_readable(bc->bio, 0))
+            return bc;
+        be_free(bc);
+    }
+}
+
+/*
+ * return a connection after a complete response - it is closed if the pool is full,
+ * it served its quota of requests, the back-end is not available or it is readable
+ */
+static void
+be_put(BACKEND *const be, BE_CONN *bc)
+{
+    int     ret_val;
+
+    if(be->alive && !be->disabled && (be->pool_reqs <= 0 || bc->n_req < be->pool_reqs) && !is_readable(bc->bio, 0)) {
+        bc->ba.reneg_state = NULL;
+        bc->last = time(NULL);
+        if(ret_val = pthread_mutex_lock(&be->mut))
+            logmsg(LOG_WARNING, "be_put() lock: %s", strerror(ret_val));
+        else {
+            if(be->n_pool < be->pool_max) {
+                bc->next = be->pool;
+                be->pool = bc;
+                be->n_pool++;
+                bc = NULL;
+            }
+            if(ret_val = pthread_mutex_unlock(&be->mut))
+                logmsg(LOG_WARNING, "be_put() unlock: %s", strerror(ret_val));
+        }
+    }
+    if(bc != NULL)
+        be_free(bc);
+    return;
+}
+
 static void
-free_headers(char **headers)
+be_pool_trim(BACKEND *const be, const time_t now)
 {
-    int     i;
+    BE_CONN *bc, **last, *old;
+    int     ret_val;
 
-    for(i = 0; i < MAXHEADERS; i++)
-        if(headers[i])
-            free(headers[i]);
-    free(headers);
+    if(be->pool_max <= 0)
+        return;
+    if(ret_val = pthread_mutex_lock(&be->mut)) {
+        logmsg(LOG_WARNING, "be_pool_trim() lock: %s", strerror(ret_val));
+        return;
+    }
+    /* most recently used first: cut the list at the first expired one */
+    if(!be->alive || be->disabled)
+        last = &be->pool;
+    else
+        for(last = &be->pool; *last != NULL && now - (*last)->last < be->pool_to; last = &(*last)->next)
+            ;
+    old = *last;
+    *last = NULL;
+    for(bc = old; bc != NULL; bc = bc->next)
+        be->n_pool--;
+    if(ret_val = pthread_mutex_unlock(&be->mut))
+        logmsg(LOG_WARNING, "be_pool_trim() unlock: %s", strerror(ret_val));
+    while((bc = old) != NULL) {
+        old = bc->next;
+        be_free(bc);
+    }
     return;
 }
 
-static char **
-get_headers(BIO *const in, BIO *const cl, const LISTENER *lstn)
+/*
+ * close the pooled back-end connections that were idle too long
+ * (and all of them for dead or disabled back-ends)
+ */
+void
+be_pool_expire(void)
 {
-    char    **headers, buf[MAXBUF];
+    LISTENER    *lstn;
+    SERVICE     *svc;
+    BACKEND     *be;
+    time_t      now;
+
+    now = time(NULL);
+    for(lstn = listeners; lstn; lstn = lstn->next)
+        for(svc = lstn->services; svc; svc = svc->next)
+            for(be = svc->backends; be; be = be->next)
+                be_pool_trim(be, now);
+    for(svc = services; svc; svc = svc->next)
+        for(be = svc->backends; be; be = be->next)
+            be_pool_trim(be, now);
+    return;
+}
+
+/*
+ * the shortest idle time-out of the back-ends that pool connections (0 if none do)
+ */
+int
+be_pool_tick(void)
+{
+    LISTENER    *lstn;
+    SERVICE     *svc;
+    BACKEND     *be;
+    int         res;
+
+    res = 0;
+    for(lstn = listeners; lstn; lstn = lstn->next)
+        for(svc = lstn->services; svc; svc = svc->next)
+            for(be = svc->backends; be; be = be->next)
+                if(be->pool_max > 0 && (res == 0 || be->pool_to < res))
+                    res = be->pool_to;
+    for(svc = services; svc; svc = svc->next)
+        for(be = svc->backends; be; be = be->next)
+            if(be->pool_max > 0 && (res == 0 || be->pool_to < res))
+                res = be->pool_to;
+    return res;
+}
+
+/*
+ * make room for need more bytes in the header arena
+ */
+static int
+hdr_room(HEADERS *const h, const int need)
+{
+    char    *arena;
+    int     size;
+
+    if(h->used + need <= h->size)
+        return 0;
+    for(size = h->size > 0? h->size: HDR_ARENA; size < h->used + need; size *= 2)
+        ;
+    if((arena = (char *)realloc(h->arena, size)) == NULL)
+        return -1;
+    h->arena = arena;
+    h->size = size;
+    return 0;
+}
+
+/*
+ * replace header line n (rewritten Location/Destination) - the new value goes at the end of the arena
+ */
+static int
+hdr_set(HEADERS *const h, const int n, const char *val)
+{
+    int len;
+
+    len = strlen(val);
+    if(hdr_room(h, len + 1))
+        return -1;
+    memcpy(h->arena + h->used, val, len + 1);
+    h->off[n] = h->used;
+    h->len[n] = len;
+    h->used += len + 1;
+    return 0;
+}
+
+/*
+ * read the request/response line and the headers into h
+ * the lines are read straight into the arena, which is kept for the next request
+ */
+static int
+get_headers(BIO *const in, BIO *const cl, const LISTENER *lstn, HEADERS *const h)
+{
+    char    *line;
     int     res, n;
 
+    h->n = h->used = 0;
+    if(hdr_room(h, MAXBUF)) {
+        logmsg(LOG_WARNING, "(%lx) e500 headers: out of memory", pthread_self());
+        err_reply(cl, h500, lstn->err500);
+        return -1;
+    }
+
     /* HTTP/1.1 allows leading CRLF */
-    memset(buf, 0, MAXBUF);
-    while((res = get_line(in, buf, MAXBUF)) == 0)
-        if(buf[0])
+    h->arena[0] = '\0';
+    while((res = get_line(in, h->arena, MAXBUF)) == 0)
+        if(h->arena[0])
             break;
 
     if(res < 0) {
         /* this is expected to occur only on client reads */
         /* logmsg(LOG_NOTICE, "headers: bad starting read"); */
-        return NULL;
-    }
-
-    if((headers = (char **)calloc(MAXHEADERS, sizeof(char *))) == NULL) {
-        logmsg(LOG_WARNING, "(%lx) e500 headers: out of memory", pthread_self());
-        err_reply(cl, h500, lstn->err500);
-        return NULL;
-    }
-    if((headers[0] = (char *)malloc(MAXBUF)) == NULL) {
-        free_headers(headers);
-        logmsg(LOG_WARNING, "(%lx) e500 header: out of memory", pthread_self());
-        err_reply(cl, h500, lstn->err500);
-        return NULL;
+        return -1;
     }
-    memset(headers[0], 0, MAXBUF);
-    strncpy(headers[0], buf, MAXBUF - 1);
+    h->off[0] = 0;
+    h->len[0] = strlen(h->arena);
+    h->used = h->len[0] + 1;
+    h->n = 1;
 
     for(n = 1; n < MAXHEADERS; n++) {
-        if(get_line(in, buf, MAXBUF)) {
-            free_headers(headers);
+        if(hdr_room(h, MAXBUF)) {
+            logmsg(LOG_WARNING, "(%lx) e500 header: out of memory", pthread_self());
+            err_reply(cl, h500, lstn->err500);
+            return -1;
+        }
+        line = h->arena + h->used;
+        if(get_line(in, line, MAXBUF))
             /* this is not necessarily an error, EOF/timeout are possible
             logmsg(LOG_WARNING, "(%lx) e500 can't read header", pthread_self());
             err_reply(cl, h500, lstn->err500);
             */
-            return NULL;
-        }
-        if(!buf[0])
-            return headers;
-        if((headers[n] = (char *)malloc(MAXBUF)) == NULL) {
-            free_headers(headers);
-            logmsg(LOG_WARNING, "(%lx) e500 header: out of memory", pthread_self());
-            err_reply(cl, h500, lstn->err500);
-            return NULL;
-        }
-        memset(headers[n], 0, MAXBUF);
-        strncpy(headers[n], buf, MAXBUF - 1);
+            return -1;
+        if(!line[0])
+            return 0;
+        h->off[n] = h->used;
+        h->len[n] = strlen(line);
+        h->used += h->len[n] + 1;
+        h->n = n + 1;
     }
 
-    free_headers(headers);
     logmsg(LOG_NOTICE, "(%lx) e500 too many headers", pthread_self());
     err_reply(cl, h500, lstn->err500);
-    return NULL;
+    return -1;
 }
 
 #define LOG_TIME_SIZE   32
@@ -536,12 +1103,323 @@ log_bytes(char *res, const LONG cnt)
 	if(ssl != NULL) { ERR_clear_error(); ERR_remove_state(0); }
 #endif
 
-#define clean_all() {   \
-    if(ssl != NULL) { BIO_ssl_shutdown(cl); } \
-    if(be != NULL) { BIO_flush(be); BIO_reset(be); BIO_free_all(be); be = NULL; } \
-    if(cl != NULL) { BIO_flush(cl); BIO_reset(cl); BIO_free_all(cl); cl = NULL; } \
-    if(x509 != NULL) { X509_free(x509); x509 = NULL; } \
-    clear_error(); \
+/* count the request as in progress on its back-end (for Balance LeastConn) */
+#define be_enter(b) { act_be = (b); __atomic_add_fetch(&act_be->n_active, 1, __ATOMIC_RELAXED); }
+#define be_leave()  { if(act_be != NULL) { __atomic_sub_fetch(&act_be->n_active, 1, __ATOMIC_RELAXED); act_be = NULL; } }
+
+#define clean_all() {   \
+    be_leave(); \
+    if(ssl != NULL) { BIO_ssl_shutdown(cl); } \
+    if(bc != NULL) { if(be != NULL) BIO_flush(be); be_free(bc); bc = NULL; be = NULL; } \
+    if(cl != NULL) { BIO_flush(cl); BIO_reset(cl); BIO_free_all(cl); cl = NULL; } \
+    if(x509 != NULL) { X509_free(x509); x509 = NULL; } \
+    if(conn != NULL) { free_conn(conn); conn = NULL; } \
+    clear_error(); \
+}
+
+/*
+ * Client connection state - it survives between requests, so that an idle
+ * keep-alive connection can be parked in the event engine and resumed later
+ * by any worker
+ */
+struct _http_conn {
+    LISTENER                *lstn;
+    int                     sock;
+    struct addrinfo         from_host;
+    struct sockaddr_storage from_host_addr;
+    BIO                     *cl;
+    SSL                     *ssl;
+    X509                    *x509;
+    RENEG_STATE             reneg_state;
+    BIO_ARG                 ba1;
+    HEADERS                 headers;    /* request/response headers, the arena is kept between requests */
+    char                    *ssl_head;  /* X-SSL-* lines for the back-end (made once per connection) */
+    int                     ssl_len;
+    const SSL_CIPHER        *ssl_cipher;/* ... for this cipher */
+    char                    *fwd_head;  /* X-Forwarded-For line and the final CRLF */
+    int                     fwd_len;
+};
+
+static void
+free_conn(HTTP_CONN *const conn)
+{
+    free(conn->headers.arena);
+    free(conn->ssl_head);
+    free(conn->fwd_head);
+    free(conn);
+    return;
+}
+
+/*
+ * the lines added to every request of the connection: X-SSL-* (made again only if a
+ * renegotiation changed the cipher) and X-Forwarded-For
+ */
+static int
+conn_heads(HTTP_CONN *const conn)
+{
+    BIO                 *hb, *bb;
+    const SSL_CIPHER    *cipher;
+    char                buf[MAXBUF], *data;
+    long                len;
+
+    if(conn->fwd_head == NULL) {
+        addr2str(buf, MAXBUF - 1, &conn->from_host, 1);
+        if((conn->fwd_head = (char *)malloc(strlen(buf) + 24)) == NULL)
+            return -1;
+        conn->fwd_len = sprintf(conn->fwd_head, "X-Forwarded-For: %s\r\n\r\n", buf);
+    }
+    if(conn->ssl == NULL)
+        return 0;
+    if((cipher = SSL_get_current_cipher(conn->ssl)) == conn->ssl_cipher && conn->ssl_head != NULL)
+        return 0;
+    free(conn->ssl_head);
+    conn->ssl_head = NULL;
+    conn->ssl_len = 0;
+    if((hb = BIO_new(BIO_s_mem())) == NULL)
+        return -1;
+    if(cipher != NULL) {
+        SSL_CIPHER_description(cipher, buf, MAXBUF - 1);
+        strip_eol(buf);
+        BIO_printf(hb, "X-SSL-cipher: %s/%s\r\n", SSL_get_version(conn->ssl), buf);
+    }
+    if(conn->lstn->clnt_check > 0 && conn->x509 != NULL && (bb = BIO_new(BIO_s_mem())) != NULL) {
+        X509_NAME_print_ex(bb, X509_get_subject_name(conn->x509), 8, XN_FLAG_ONELINE & ~ASN1_STRFLGS_ESC_MSB);
+        get_line(bb, buf, MAXBUF);
+        BIO_printf(hb, "X-SSL-Subject: %s\r\n", buf);
+        X509_NAME_print_ex(bb, X509_get_issuer_name(conn->x509), 8, XN_FLAG_ONELINE & ~ASN1_STRFLGS_ESC_MSB);
+        get_line(bb, buf, MAXBUF);
+        BIO_printf(hb, "X-SSL-Issuer: %s\r\n", buf);
+        ASN1_TIME_print(bb, X509_get_notBefore(conn->x509));
+        get_line(bb, buf, MAXBUF);
+        BIO_printf(hb, "X-SSL-notBefore: %s\r\n", buf);
+        ASN1_TIME_print(bb, X509_get_notAfter(conn->x509));
+        get_line(bb, buf, MAXBUF);
+        BIO_printf(hb, "X-SSL-notAfter: %s\r\n", buf);
+        BIO_printf(hb, "X-SSL-serial: %ld\r\n", ASN1_INTEGER_get(X509_get_serialNumber(conn->x509)));
+        PEM_write_bio_X509(bb, conn->x509);
+        get_line(bb, buf, MAXBUF);
+        BIO_printf(hb, "X-SSL-certificate: %s", buf);
+        while(get_line(bb, buf, MAXBUF) == 0)
+            BIO_printf(hb, "%s", buf);
+        BIO_printf(hb, "\r\n");
+        BIO_free_all(bb);
+    }
+    if((len = BIO_get_mem_data(hb, &data)) < 0 || (conn->ssl_head = (char *)malloc(len + 1)) == NULL) {
+        BIO_free_all(hb);
+        return -1;
+    }
+    memcpy(conn->ssl_head, data, len);
+    conn->ssl_len = len;
+    conn->ssl_cipher = cipher;
+    BIO_free_all(hb);
+    return 0;
+}
+
+/*
+ * set up a freshly accepted client connection (SSL handshake included)
+ */
+static HTTP_CONN *
+new_conn(const thr_arg *arg)
+{
+    HTTP_CONN       *conn;
+    LISTENER        *lstn;
+    BIO             *cl, *bb;
+    SSL             *ssl;
+    X509            *x509;
+    char            caddr[MAXBUF];
+    struct linger   l;
+    int             n, sock;
+
+    lstn = arg->lstn;
+    sock = arg->sock;
+    if((conn = (HTTP_CONN *)malloc(sizeof(HTTP_CONN))) == NULL) {
+        logmsg(LOG_WARNING, "(%lx) connection: out of memory", pthread_self());
+        shutdown(sock, 2);
+        close(sock);
+        return NULL;
+    }
+    memset(conn, 0, sizeof(HTTP_CONN));
+    conn->lstn = lstn;
+    conn->sock = sock;
+    memcpy(&conn->from_host_addr, &arg->from_addr, arg->from_len);
+    conn->from_host.ai_family = arg->from_addr.ss_family;
+    conn->from_host.ai_addrlen = arg->from_len;
+    conn->from_host.ai_addr = (struct sockaddr *)&conn->from_host_addr;
+
+    conn->reneg_state = RENEG_INIT;
+    conn->ba1.reneg_state = &conn->reneg_state;
+    if(lstn->allow_client_reneg)
+        conn->reneg_state = RENEG_ALLOW;
+
+    n = 1;
+    setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, (void *)&n, sizeof(n));
+    l.l_onoff = 1;
+    l.l_linger = 10;
+    setsockopt(sock, SOL_SOCKET, SO_LINGER, (void *)&l, sizeof(l));
+#ifdef  TCP_LINGER2
+    n = 5;
+    setsockopt(sock, SOL_TCP, TCP_LINGER2, (void *)&n, sizeof(n));
+#endif
+    n = 1;
+    setsockopt(sock, SOL_TCP, TCP_NODELAY, (void *)&n, sizeof(n));
+
+    if((cl = BIO_new_socket(sock, 1)) == NULL) {
+        logmsg(LOG_WARNING, "(%lx) BIO_new_socket failed", pthread_self());
+        shutdown(sock, 2);
+        close(sock);
+        free(conn);
+        return NULL;
+    }
+    conn->ba1.timeout = lstn->to;
+    BIO_set_callback_arg(cl, (char *)&conn->ba1);
+    BIO_set_callback(cl, bio_callback);
+
+    if(lstn->ctx != NULL) {
+        if((ssl = SSL_new(lstn->ctx->ctx)) == NULL) {
+            logmsg(LOG_WARNING, "(%lx) SSL_new: failed", pthread_self());
+            BIO_reset(cl);
+            BIO_free_all(cl);
+            free(conn);
+            return NULL;
+        }
+        SSL_set_app_data(ssl, &conn->reneg_state);
+        SSL_set_bio(ssl, cl, cl);
+        if((bb = BIO_new(BIO_f_ssl())) == NULL) {
+            logmsg(LOG_WARNING, "(%lx) BIO_new(Bio_f_ssl()) failed", pthread_self());
+            BIO_reset(cl);
+            BIO_free_all(cl);
+            free(conn);
+            return NULL;
+        }
+        BIO_set_ssl(bb, ssl, BIO_CLOSE);
+        BIO_set_ssl_mode(bb, 0);
+        cl = bb;
+        if(BIO_do_handshake(cl) <= 0) {
+            /* no need to log every client without a certificate...
+            addr2str(caddr, MAXBUF - 1, &conn->from_host, 1);
+            logmsg(LOG_NOTICE, "BIO_do_handshake with %s failed: %s", caddr,
+                ERR_error_string(ERR_get_error(), NULL));
+            x509 = NULL;
+            */
+            BIO_reset(cl);
+            BIO_free_all(cl);
+            free(conn);
+            return NULL;
+        } else {
+            if((x509 = SSL_get_peer_certificate(ssl)) != NULL && lstn->clnt_check < 3
+            && SSL_get_verify_result(ssl) != X509_V_OK) {
+                addr2str(caddr, MAXBUF - 1, &conn->from_host, 1);
+                logmsg(LOG_NOTICE, "Bad certificate from %s", caddr);
+                X509_free(x509);
+                BIO_reset(cl);
+                BIO_free_all(cl);
+                free(conn);
+                return NULL;
+            }
+        }
+    } else {
+        ssl = NULL;
+        x509 = NULL;
+    }
+
+    if((bb = BIO_new_linebuf()) == NULL) {
+        logmsg(LOG_WARNING, "(%lx) BIO_new(buffer) failed", pthread_self());
+        if(x509 != NULL)
+            X509_free(x509);
+        BIO_reset(cl);
+        BIO_free_all(cl);
+        free(conn);
+        return NULL;
+    }
+    BIO_set_close(cl, BIO_CLOSE);
+    conn->cl = BIO_push(bb, cl);
+    conn->ssl = ssl;
+    conn->x509 = x509;
+    return conn;
+}
+
+/*
+ * close a connection nobody is going to process (event engine time-out, full queue)
+ */
+void
+drop_conn(thr_arg *arg, const int err)
+{
+    HTTP_CONN       *conn;
+    struct addrinfo from_host;
+    char            caddr[MAXBUF];
+
+    if((conn = arg->conn) == NULL) {
+        /* never got as far as the first request */
+        if(err) {
+            memset(&from_host, 0, sizeof(from_host));
+            from_host.ai_family = arg->from_addr.ss_family;
+            from_host.ai_addrlen = arg->from_len;
+            from_host.ai_addr = (struct sockaddr *)&arg->from_addr;
+            addr2str(caddr, MAXBUF - 1, &from_host, 1);
+            logmsg(LOG_NOTICE, "(%lx) error read from %s: %s", pthread_self(), caddr, strerror(err));
+        }
+        shutdown(arg->sock, 2);
+        close(arg->sock);
+        return;
+    }
+    if(conn->ssl != NULL) {
+        SSL_set_shutdown(conn->ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+        BIO_ssl_shutdown(conn->cl);
+    }
+    BIO_reset(conn->cl);
+    BIO_free_all(conn->cl);
+    if(conn->x509 != NULL)
+        X509_free(conn->x509);
+    free_conn(conn);
+    return;
+}
+
+/*
+ * prepare the 503 reply for shed clients, so that overload costs us a single write
+ */
+void
+init_shed(LISTENER *lstn)
+{
+    int n;
+
+    n = strlen(err_response) + strlen(h503) + strlen(lstn->err503) + 16;
+    if((lstn->shed503 = (char *)malloc(n)) == NULL) {
+        logmsg(LOG_ERR, "init_shed: out of memory - aborted");
+        exit(1);
+    }
+    lstn->shed503_len = snprintf(lstn->shed503, n, err_response, h503, strlen(lstn->err503), lstn->err503);
+    return;
+}
+
+/*
+ * turn a client away with a 503 without processing the request (overload)
+ * the reply is never waited for (the event thread calls this too), so HTTPS
+ * clients are just closed
+ */
+void
+shed_conn(thr_arg *arg)
+{
+    HTTP_CONN   *conn;
+    char        buf[MAXBUF];
+
+    if((conn = arg->conn) != NULL) {
+        /* a kept-alive connection: a client that does not read must not hold us up */
+        if(conn->ssl == NULL) {
+            (void)send(conn->sock, arg->lstn->shed503, arg->lstn->shed503_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+            while(recv(conn->sock, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+                ;
+        }
+        drop_conn(arg, 0);
+        return;
+    }
+    if(arg->lstn->ctx == NULL)
+        (void)send(arg->sock, arg->lstn->shed503, arg->lstn->shed503_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    /* read whatever the client sent already, so close() does not turn into a reset */
+    while(recv(arg->sock, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+        ;
+    shutdown(arg->sock, 2);
+    close(arg->sock);
+    return;
 }
 
 /*
@@ -550,24 +1428,25 @@ log_bytes(char *res, const LONG cnt)
 void
 do_http(thr_arg *arg)
 {
-    int                 cl_11, be_11, res, chunked, n, sock, no_cont, skip, conn_closed, force_10, sock_proto, is_rpc, is_ws;
+    int                 cl_11, be_11, res, chunked, n, sock, no_cont, skip, conn_closed, force_10, sock_proto, is_rpc, is_ws, hd,
+                        meth, u_off, u_len;
+    HTTP_CONN           *conn;
+    HEADERS             *headers;
     LISTENER            *lstn;
     SERVICE             *svc;
-    BACKEND             *backend, *cur_backend, *old_backend;
+    BACKEND             *backend, *cur_backend, *old_backend, *act_be;
     struct addrinfo     from_host, z_addr;
-    struct sockaddr_storage from_host_addr;
     BIO                 *cl, *be, *bb, *b64;
+    BE_CONN             *bc;
     X509                *x509;
-    char                request[MAXBUF], response[MAXBUF], buf[MAXBUF], url[MAXBUF], loc_path[MAXBUF], **headers,
-                        headers_ok[MAXHEADERS], v_host[MAXBUF], referer[MAXBUF], u_agent[MAXBUF], u_name[MAXBUF],
+    char                request[MAXBUF], response[MAXBUF], buf[MAXBUF], url[MAXBUF], loc_path[MAXBUF],
+                        headers_ok[MAXHEADERS], is_dest[MAXHEADERS], v_host[MAXBUF], referer[MAXBUF], u_agent[MAXBUF], u_name[MAXBUF],
                         caddr[MAXBUF], req_time[LOG_TIME_SIZE], s_res_bytes[LOG_BYTES_SIZE], *mh;
     SSL                 *ssl, *be_ssl;
     LONG                cont, res_bytes;
     regmatch_t          matches[4];
     struct linger       l;
-    double              start_req, end_req;
-    RENEG_STATE         reneg_state;
-    BIO_ARG             ba1, ba2;
+    double              start_req, end_req, start_be;
     enum {
 	    WSS_REQ_GET                        = 0x01,
 	    WSS_REQ_HEADER_CONNECTION_UPGRADE  = 0x02,
@@ -583,115 +1462,61 @@ do_http(thr_arg *arg)
 	                   | WSS_RESP_HEADER_CONNECTION_UPGRADE
 	                   | WSS_RESP_HEADER_UPGRADE_WEBSOCKET
     };
-	    
-    reneg_state = RENEG_INIT;
-    ba1.reneg_state =  &reneg_state;
-    ba2.reneg_state = &reneg_state;
-    ba1.timeout = 0;
-    ba2.timeout = 0;
-    from_host = ((thr_arg *)arg)->from_host;
-    memcpy(&from_host_addr, from_host.ai_addr, from_host.ai_addrlen);
-    from_host.ai_addr = (struct sockaddr *)&from_host_addr;
-    lstn = ((thr_arg *)arg)->lstn;
-    sock = ((thr_arg *)arg)->sock;
-    free(((thr_arg *)arg)->from_host.ai_addr);
-    free(arg);
-
-    if(lstn->allow_client_reneg)
-        reneg_state = RENEG_ALLOW;
-
-    n = 1;
-    setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, (void *)&n, sizeof(n));
-    l.l_onoff = 1;
-    l.l_linger = 10;
-    setsockopt(sock, SOL_SOCKET, SO_LINGER, (void *)&l, sizeof(l));
-#ifdef  TCP_LINGER2
-    n = 5;
-    setsockopt(sock, SOL_TCP, TCP_LINGER2, (void *)&n, sizeof(n));
-#endif
-    n = 1;
-    setsockopt(sock, SOL_TCP, TCP_NODELAY, (void *)&n, sizeof(n));
 
-    cl = NULL;
-    be = NULL;
-    ssl = NULL;
-    x509 = NULL;
-
-    if((cl = BIO_new_socket(sock, 1)) == NULL) {
-        logmsg(LOG_WARNING, "(%lx) BIO_new_socket failed", pthread_self());
-        shutdown(sock, 2);
-        close(sock);
+    if(arg->lstn->max_qwait > 0 && mono_ms() - arg->t_accept > arg->lstn->max_qwait) {
+        /* waited too long in the queue - the client has most likely given up by now */
+        shed_conn(arg);
         return;
     }
-    ba1.timeout = lstn->to;
-    BIO_set_callback_arg(cl, (char *)&ba1);
-    BIO_set_callback(cl, bio_callback);
-
-    if(lstn->ctx != NULL) {
-        if((ssl = SSL_new(lstn->ctx->ctx)) == NULL) {
-            logmsg(LOG_WARNING, "(%lx) SSL_new: failed", pthread_self());
-            BIO_reset(cl);
-            BIO_free_all(cl);
-            return;
-        }
-        SSL_set_app_data(ssl, &reneg_state);
-        SSL_set_bio(ssl, cl, cl);
-        if((bb = BIO_new(BIO_f_ssl())) == NULL) {
-            logmsg(LOG_WARNING, "(%lx) BIO_new(Bio_f_ssl()) failed", pthread_self());
-            BIO_reset(cl);
-            BIO_free_all(cl);
-            return;
-        }
-        BIO_set_ssl(bb, ssl, BIO_CLOSE);
-        BIO_set_ssl_mode(bb, 0);
-        cl = bb;
-        if(BIO_do_handshake(cl) <= 0) {
-            /* no need to log every client without a certificate...
-            addr2str(caddr, MAXBUF - 1, &from_host, 1);
-            logmsg(LOG_NOTICE, "BIO_do_handshake with %s failed: %s", caddr,
-                ERR_error_string(ERR_get_error(), NULL));
-            x509 = NULL;
-            */
-            BIO_reset(cl);
-            BIO_free_all(cl);
-            return;
-        } else {
-            if((x509 = SSL_get_peer_certificate(ssl)) != NULL && lstn->clnt_check < 3
-            && SSL_get_verify_result(ssl) != X509_V_OK) {
-                addr2str(caddr, MAXBUF - 1, &from_host, 1);
-                logmsg(LOG_NOTICE, "Bad certificate from %s", caddr);
-                X509_free(x509);
-                BIO_reset(cl);
-                BIO_free_all(cl);
-                return;
-            }
-        }
-    } else {
-        x509 = NULL;
-    }
-    cur_backend = NULL;
 
-    if((bb = BIO_new(BIO_f_buffer())) == NULL) {
-        logmsg(LOG_WARNING, "(%lx) BIO_new(buffer) failed", pthread_self());
-        if(x509 != NULL)
-            X509_free(x509);
-        BIO_reset(cl);
-        BIO_free_all(cl);
+    cl_11 = be_11 = 0;
+    if((conn = arg->conn) != NULL)
+        /* a parked keep-alive connection: the previous request was HTTP/1.1 */
+        cl_11 = 1;
+    else if((conn = new_conn(arg)) == NULL)
         return;
-    }
-    BIO_set_close(cl, BIO_CLOSE);
-    BIO_set_buffer_size(cl, MAXBUF);
-    cl = BIO_push(bb, cl);
+    lstn = conn->lstn;
+    from_host = conn->from_host;
+    headers = &conn->headers;
+    cl = conn->cl;
+    ssl = conn->ssl;
+    x509 = conn->x509;
+    be = NULL;
+    bc = NULL;
+    cur_backend = NULL;
+    act_be = NULL;
 
-    for(cl_11 = be_11 = 0;;) {
+    for(;;) {
+        /* the previous request (if any) is over */
+        be_leave();
+        if(cl_11 && (ev_threads > 0 || park_idle) && !is_readable(cl, 0)) {
+            thr_arg park;
+
+            /* idle keep-alive connection - let the event engine wait for the next request */
+            if(bc != NULL) {
+                be_free(bc);
+                bc = NULL;
+                be = NULL;
+            }
+            clear_error();
+            park.sock = conn->sock;
+            park.lstn = lstn;
+            memcpy(&park.from_addr, &conn->from_host_addr, conn->from_host.ai_addrlen);
+            park.from_len = conn->from_host.ai_addrlen;
+            park.conn = conn;
+            if(!ev_park(&park, lstn->to))
+                return;
+        }
         res_bytes = L0;
         is_rpc = -1;
         is_ws = 0;
         v_host[0] = referer[0] = u_agent[0] = u_name[0] = '\0';
         conn_closed = 0;
-        for(n = 0; n < MAXHEADERS; n++)
+        for(n = 0; n < MAXHEADERS; n++) {
             headers_ok[n] = 1;
-        if((headers = get_headers(cl, cl, lstn)) == NULL) {
+            is_dest[n] = 0;
+        }
+        if(get_headers(cl, cl, lstn, headers)) {
             if(!cl_11) {
                 if(errno) {
                     addr2str(caddr, MAXBUF - 1, &from_host, 1);
@@ -707,31 +1532,28 @@ do_http(thr_arg *arg)
         log_time(req_time);
 
         /* check for correct request */
-        strncpy(request, headers[0], MAXBUF);
-        if(!regexec(&lstn->verb, request, 3, matches, 0)) {
-            no_cont = !strncasecmp(request + matches[1].rm_so, "HEAD", matches[1].rm_eo - matches[1].rm_so);
-            if(!strncasecmp(request + matches[1].rm_so, "RPC_IN_DATA", matches[1].rm_eo - matches[1].rm_so))
-                is_rpc = 1;
-            else if(!strncasecmp(request + matches[1].rm_so, "RPC_OUT_DATA", matches[1].rm_eo - matches[1].rm_so))
-                is_rpc = 0;
-            else if(!strncasecmp(request + matches[1].rm_so, "GET", matches[1].rm_eo - matches[1].rm_so))
-                is_ws |= WSS_REQ_GET;
-        } else {
+        strncpy(request, HDR(headers, 0), MAXBUF);
+        if((meth = check_request(request, &u_off, &u_len)) < 0 || !(lstn->verb & (1U << meth))) {
             addr2str(caddr, MAXBUF - 1, &from_host, 1);
             logmsg(LOG_WARNING, "(%lx) e501 bad request \"%s\" from %s", pthread_self(), request, caddr);
             err_reply(cl, h501, lstn->err501);
-            free_headers(headers);
             clean_all();
             return;
         }
+        no_cont = (meth == METH_HEAD);
+        if(meth == METH_RPC_IN_DATA)
+            is_rpc = 1;
+        else if(meth == METH_RPC_OUT_DATA)
+            is_rpc = 0;
+        else if(meth == METH_GET)
+            is_ws |= WSS_REQ_GET;
         cl_11 = (request[strlen(request) - 1] == '1');
-        n = cpURL(url, request + matches[2].rm_so, matches[2].rm_eo - matches[2].rm_so);
+        n = cpURL(url, request + u_off, u_len);
         if(n != strlen(url)) {
             /* the URL probably contained a %00 aka NULL - which we don't allow */
             addr2str(caddr, MAXBUF - 1, &from_host, 1);
             logmsg(LOG_NOTICE, "(%lx) e501 URL \"%s\" (contains NULL) from %s", pthread_self(), url, caddr);
             err_reply(cl, h501, lstn->err501);
-            free_headers(headers);
             clean_all();
             return;
         }
@@ -739,15 +1561,14 @@ do_http(thr_arg *arg)
             addr2str(caddr, MAXBUF - 1, &from_host, 1);
             logmsg(LOG_NOTICE, "(%lx) e501 bad URL \"%s\" from %s", pthread_self(), url, caddr);
             err_reply(cl, h501, lstn->err501);
-            free_headers(headers);
             clean_all();
             return;
         }
 
         /* check other headers */
-        for(chunked = 0, cont = L_1, n = 1; n < MAXHEADERS && headers[n]; n++) {
+        for(chunked = 0, cont = L_1, n = 1; n < headers->n; n++) {
             /* no overflow - see check_header for details */
-            switch(check_header(headers[n], buf)) {
+            switch(hd = check_header(HDR(headers, n), buf)) {
             case HEADER_HOST:
                 strcpy(v_host, buf);
                 break;
@@ -775,7 +1596,6 @@ do_http(thr_arg *arg)
                     addr2str(caddr, MAXBUF - 1, &from_host, 1);
                     logmsg(LOG_NOTICE, "(%lx) e400 multiple Transfer-encoding \"%s\" from %s", pthread_self(), url, caddr);
                     err_reply(cl, h400, "Bad request: multiple Transfer-encoding values");
-                    free_headers(headers);
                     clean_all();
                     return;
                 }
@@ -785,7 +1605,6 @@ do_http(thr_arg *arg)
                     addr2str(caddr, MAXBUF - 1, &from_host, 1);
                     logmsg(LOG_NOTICE, "(%lx) e400 multiple Content-length \"%s\" from %s", pthread_self(), url, caddr);
                     err_reply(cl, h400, "Bad request: multiple Content-length values");
-                    free_headers(headers);
                     clean_all();
                     return;
                 }
@@ -794,7 +1613,6 @@ do_http(thr_arg *arg)
                         addr2str(caddr, MAXBUF - 1, &from_host, 1);
                         logmsg(LOG_NOTICE, "(%lx) e400 Content-length bad value \"%s\" from %s", pthread_self(), url, caddr);
                         err_reply(cl, h400, "Bad request: Content-length bad value");
-                        free_headers(headers);
                         clean_all();
                     return;
                     }
@@ -812,10 +1630,14 @@ do_http(thr_arg *arg)
                 if(!strcasecmp("100-continue", buf))
                     headers_ok[n] = 0;
                 break;
+            case HEADER_DESTINATION:
+                /* remembered for the rewrite once we know the back-end */
+                is_dest[n] = 1;
+                break;
             case HEADER_ILLEGAL:
                 if(lstn->log_level > 0) {
                     addr2str(caddr, MAXBUF - 1, &from_host, 1);
-                    logmsg(LOG_NOTICE, "(%lx) bad header from %s (%s)", pthread_self(), caddr, headers[n]);
+                    logmsg(LOG_NOTICE, "(%lx) bad header from %s (%s)", pthread_self(), caddr, HDR(headers, n));
                 }
                 headers_ok[n] = 0;
                 break;
@@ -825,13 +1647,19 @@ do_http(thr_arg *arg)
                 MATCHER *m;
 
                 for(m = lstn->head_off; m; m = m->next)
-                    if(!(headers_ok[n] = regexec(&m->pat, headers[n], 0, NULL, 0)))
+                    if(!(headers_ok[n] = regexec(&m->pat, HDR(headers, n), 0, NULL, 0)))
                         break;
             }
-            /* get User name */
-            if(!regexec(&AUTHORIZATION, headers[n], 2, matches, 0)) {
+            /* get User name - Basic [ \t]* "? credentials */
+            if(hd == HEADER_AUTHORIZATION && !strncasecmp(buf, "Basic", 5)) {
                 int inlen;
 
+                for(mh = buf + 5; *mh == ' ' || *mh == '\t'; mh++)
+                    ;
+                if(*mh == '"')
+                    mh++;
+                inlen = strcspn(mh, " \t");
+
                 if((bb = BIO_new(BIO_s_mem())) == NULL) {
                     logmsg(LOG_WARNING, "(%lx) Can't alloc BIO_s_mem", pthread_self());
                     continue;
@@ -842,7 +1670,7 @@ do_http(thr_arg *arg)
                     continue;
                 }
                 b64 = BIO_push(b64, bb);
-                BIO_write(bb, headers[n] + matches[1].rm_so, matches[1].rm_eo - matches[1].rm_so);
+                BIO_write(bb, mh, inlen);
                 BIO_write(bb, "\n", 1);
                 if((inlen = BIO_read(b64, buf, MAXBUF - 1)) <= 0) {
                     logmsg(LOG_WARNING, "(%lx) Can't read BIO_f_base64", pthread_self());
@@ -864,7 +1692,6 @@ do_http(thr_arg *arg)
             addr2str(caddr, MAXBUF - 1, &from_host, 1);
             logmsg(LOG_NOTICE, "(%lx) e501 Transfer-encoding and Content-length \"%s\" from %s", pthread_self(), url, caddr);
             err_reply(cl, h400, "Bad request: Transfer-encoding and Content-length headers present");
-            free_headers(headers);
             clean_all();
             return;
         }
@@ -874,7 +1701,6 @@ do_http(thr_arg *arg)
             addr2str(caddr, MAXBUF - 1, &from_host, 1);
             logmsg(LOG_NOTICE, "(%lx) e501 request too large (%ld) from %s", pthread_self(), cont, caddr);
             err_reply(cl, h501, lstn->err501);
-            free_headers(headers);
             clean_all();
             return;
         }
@@ -882,36 +1708,41 @@ do_http(thr_arg *arg)
         if(be != NULL) {
             if(is_readable(be, 0)) {
                 /* The only way it's readable is if it's at EOF, so close it! */
-                BIO_reset(be);
-                BIO_free_all(be);
+                be_free(bc);
+                bc = NULL;
                 be = NULL;
             }
         }
 
         /* check that the requested URL still fits the old back-end (if any) */
-        if((svc = get_service(lstn, url, &headers[1])) == NULL) {
+        if((svc = get_service(lstn, url, headers)) == NULL) {
             addr2str(caddr, MAXBUF - 1, &from_host, 1);
             logmsg(LOG_NOTICE, "(%lx) e503 no service \"%s\" from %s %s", pthread_self(), request, caddr, v_host[0]? v_host: "-");
             err_reply(cl, h503, lstn->err503);
-            free_headers(headers);
             clean_all();
             return;
         }
-        if((backend = get_backend(svc, &from_host, url, &headers[1])) == NULL) {
+        if((backend = get_backend(svc, &from_host, url, headers)) == NULL) {
             addr2str(caddr, MAXBUF - 1, &from_host, 1);
             logmsg(LOG_NOTICE, "(%lx) e503 no back-end \"%s\" from %s %s", pthread_self(), request, caddr, v_host[0]? v_host: "-");
             err_reply(cl, h503, lstn->err503);
-            free_headers(headers);
             clean_all();
             return;
         }
+        be_enter(backend);
 
         if(be != NULL && backend != cur_backend) {
-            BIO_reset(be);
-            BIO_free_all(be);
+            be_free(bc);
+            bc = NULL;
             be = NULL;
         }
         while(be == NULL && backend->be_type == 0) {
+            /* an idle connection from the pool, if there is one */
+            if(backend->pool_max > 0 && (bc = be_get(backend)) != NULL) {
+                bc->ba.reneg_state = &conn->reneg_state;
+                be = bc->bio;
+                continue;
+            }
             switch(backend->addr.ai_family) {
             case AF_INET:
                 sock_proto = PF_INET;
@@ -925,7 +1756,6 @@ do_http(thr_arg *arg)
             default:
                 logmsg(LOG_WARNING, "(%lx) e503 backend: unknown family %d", pthread_self(), backend->addr.ai_family);
                 err_reply(cl, h503, lstn->err503);
-                free_headers(headers);
                 clean_all();
                 return;
             }
@@ -933,7 +1763,6 @@ do_http(thr_arg *arg)
                 str_be(buf, MAXBUF - 1, backend);
                 logmsg(LOG_WARNING, "(%lx) e503 backend %s socket create: %s", pthread_self(), buf, strerror(errno));
                 err_reply(cl, h503, lstn->err503);
-                free_headers(headers);
                 clean_all();
                 return;
             }
@@ -953,14 +1782,15 @@ do_http(thr_arg *arg)
                  * ...but make sure we don't get into a loop with the same back-end
                  */
                 old_backend = backend;
-                if((backend = get_backend(svc, &from_host, url, &headers[1])) == NULL || backend == old_backend) {
+                be_leave();
+                if((backend = get_backend(svc, &from_host, url, headers)) == NULL || backend == old_backend) {
                     addr2str(caddr, MAXBUF - 1, &from_host, 1);
                     logmsg(LOG_NOTICE, "(%lx) e503 no back-end \"%s\" from %s", pthread_self(), request, caddr);
                     err_reply(cl, h503, lstn->err503);
-                    free_headers(headers);
                     clean_all();
                     return;
                 }
+                be_enter(backend);
                 continue;
             }
             if(sock_proto == PF_INET || sock_proto == PF_INET6) {
@@ -976,244 +1806,149 @@ do_http(thr_arg *arg)
                 n = 1;
                 setsockopt(sock, SOL_TCP, TCP_NODELAY, (void *)&n, sizeof(n));
             }
+            if((bc = (BE_CONN *)malloc(sizeof(BE_CONN))) == NULL) {
+                logmsg(LOG_WARNING, "(%lx) e503 back-end connection: out of memory", pthread_self());
+                shutdown(sock, 2);
+                close(sock);
+                err_reply(cl, h503, lstn->err503);
+                clean_all();
+                return;
+            }
+            memset(bc, 0, sizeof(BE_CONN));
+            bc->ba.reneg_state = &conn->reneg_state;
             if((be = BIO_new_socket(sock, 1)) == NULL) {
                 logmsg(LOG_WARNING, "(%lx) e503 BIO_new_socket server failed", pthread_self());
                 shutdown(sock, 2);
                 close(sock);
                 err_reply(cl, h503, lstn->err503);
-                free_headers(headers);
                 clean_all();
                 return;
             }
+            bc->bio = be;
             BIO_set_close(be, BIO_CLOSE);
             if(backend->to > 0) {
-                ba2.timeout = backend->to;
-                BIO_set_callback_arg(be, (char *)&ba2);
+                bc->ba.timeout = backend->to;
+                BIO_set_callback_arg(be, (char *)&bc->ba);
                 BIO_set_callback(be, bio_callback);
             }
             if(backend->ctx != NULL) {
                 if((be_ssl = SSL_new(backend->ctx)) == NULL) {
                     logmsg(LOG_WARNING, "(%lx) be SSL_new: failed", pthread_self());
                     err_reply(cl, h503, lstn->err503);
-                    free_headers(headers);
                     clean_all();
                     return;
                 }
                 SSL_set_bio(be_ssl, be, be);
+                be_resume(backend, be_ssl);
                 if((bb = BIO_new(BIO_f_ssl())) == NULL) {
                     logmsg(LOG_WARNING, "(%lx) BIO_new(Bio_f_ssl()) failed", pthread_self());
                     err_reply(cl, h503, lstn->err503);
-                    free_headers(headers);
                     clean_all();
                     return;
                 }
                 BIO_set_ssl(bb, be_ssl, BIO_CLOSE);
                 BIO_set_ssl_mode(bb, 1);
-                be = bb;
+                bc->bio = be = bb;
                 if(BIO_do_handshake(be) <= 0) {
                     str_be(buf, MAXBUF - 1, backend);
                     logmsg(LOG_NOTICE, "BIO_do_handshake with %s failed: %s", buf,
                         ERR_error_string(ERR_get_error(), NULL));
                     err_reply(cl, h503, lstn->err503);
-                    free_headers(headers);
                     clean_all();
                     return;
                 }
+                if(SSL_session_reused(be_ssl))
+                    __atomic_add_fetch(&backend->sess_hits, 1, __ATOMIC_RELAXED);
+                else
+                    __atomic_add_fetch(&backend->sess_misses, 1, __ATOMIC_RELAXED);
             }
-            if((bb = BIO_new(BIO_f_buffer())) == NULL) {
+            if((bb = BIO_new_linebuf()) == NULL) {
                 logmsg(LOG_WARNING, "(%lx) e503 BIO_new(buffer) server failed", pthread_self());
                 err_reply(cl, h503, lstn->err503);
-                free_headers(headers);
                 clean_all();
                 return;
             }
-            BIO_set_buffer_size(bb, MAXBUF);
             BIO_set_close(bb, BIO_CLOSE);
-            be = BIO_push(bb, be);
+            bc->bio = be = BIO_push(bb, be);
         }
         cur_backend = backend;
 
         /* if we have anything but a BACK_END we close the channel */
         if(be != NULL && cur_backend->be_type) {
-            BIO_reset(be);
-            BIO_free_all(be);
+            be_free(bc);
+            bc = NULL;
             be = NULL;
         }
 
         /* send the request */
         if(cur_backend->be_type == 0) {
-            for(n = 0; n < MAXHEADERS && headers[n]; n++) {
-                if(!headers_ok[n])
+            struct iovec    iov[2 * MAXHEADERS + 4];
+            int             n_hd, n_iov, tot;
+
+            /* this is the earliest we can check for Destination - we had no back-end before */
+            for(n_hd = 0; n_hd < headers->n; n_hd++) {
+                if(!headers_ok[n_hd] || !lstn->rewr_dest || !is_dest[n_hd])
                     continue;
-                /* this is the earliest we can check for Destination - we had no back-end before */
-                if(lstn->rewr_dest && check_header(headers[n], buf) == HEADER_DESTINATION) {
-                    if(regexec(&LOCATION, buf, 4, matches, 0)) {
-                        logmsg(LOG_NOTICE, "(%lx) Can't parse Destination %s", pthread_self(), buf);
-                        break;
-                    }
-                    str_be(caddr, MAXBUF - 1, cur_backend);
-                    strcpy(loc_path, buf + matches[3].rm_so);
-                    snprintf(buf, MAXBUF, "Destination: http://%s%s", caddr, loc_path);
-                    free(headers[n]);
-                    if((headers[n] = strdup(buf)) == NULL) {
-                        logmsg(LOG_WARNING, "(%lx) rewrite Destination - out of memory: %s",
-                            pthread_self(), strerror(errno));
-                        free_headers(headers);
-                        clean_all();
-                        return;
-                    }
+                /* value view: skip "Destination:" and the blanks */
+                for(mh = HDR(headers, n_hd) + 12; *mh == ' ' || *mh == '\t'; mh++)
+                    ;
+                if(regexec(&LOCATION, mh, 4, matches, 0)) {
+                    /* the headers from here on are not sent */
+                    logmsg(LOG_NOTICE, "(%lx) Can't parse Destination %s", pthread_self(), mh);
+                    break;
                 }
-                if(BIO_printf(be, "%s\r\n", headers[n]) <= 0) {
-                    str_be(buf, MAXBUF - 1, cur_backend);
-                    end_req = cur_time();
-                    logmsg(LOG_WARNING, "(%lx) e500 error write to %s/%s: %s (%.3f sec)",
-                        pthread_self(), buf, request, strerror(errno),
-                        (end_req - start_req) / 1000000.0);
-                    err_reply(cl, h500, lstn->err500);
-                    free_headers(headers);
+                str_be(caddr, MAXBUF - 1, cur_backend);
+                strcpy(loc_path, mh + matches[3].rm_so);
+                snprintf(buf, MAXBUF, "Destination: http://%s%s", caddr, loc_path);
+                if(hdr_set(headers, n_hd, buf)) {
+                    logmsg(LOG_WARNING, "(%lx) rewrite Destination - out of memory: %s",
+                        pthread_self(), strerror(errno));
                     clean_all();
                     return;
                 }
             }
-            /* add header if required */
-            if(lstn->add_head != NULL)
-                if(BIO_printf(be, "%s\r\n", lstn->add_head) <= 0) {
-                    str_be(buf, MAXBUF - 1, cur_backend);
-                    end_req = cur_time();
-                    logmsg(LOG_WARNING, "(%lx) e500 error write AddHeader to %s: %s (%.3f sec)",
-                        pthread_self(), buf, strerror(errno), (end_req - start_req) / 1000000.0);
-                    err_reply(cl, h500, lstn->err500);
-                    free_headers(headers);
-                    clean_all();
-                    return;
-                }
-        }
-        free_headers(headers);
-
-        /* if SSL put additional headers for client certificate */
-        if(cur_backend->be_type == 0 && ssl != NULL) {
-            const SSL_CIPHER  *cipher;
-
-            if((cipher = SSL_get_current_cipher(ssl)) != NULL) {
-                SSL_CIPHER_description(cipher, buf, MAXBUF - 1);
-                strip_eol(buf);
-                if(BIO_printf(be, "X-SSL-cipher: %s/%s\r\n", SSL_get_version(ssl), buf) <= 0) {
-                    str_be(buf, MAXBUF - 1, cur_backend);
-                    end_req = cur_time();
-                    logmsg(LOG_WARNING, "(%lx) e500 error write X-SSL-cipher to %s: %s (%.3f sec)",
-                        pthread_self(), buf, strerror(errno), (end_req - start_req) / 1000000.0);
-                    err_reply(cl, h500, lstn->err500);
-                    clean_all();
-                    return;
-                }
+            if(conn_heads(conn)) {
+                logmsg(LOG_WARNING, "(%lx) e500 headers for %s - out of memory: %s",
+                    pthread_self(), request, strerror(errno));
+                err_reply(cl, h500, lstn->err500);
+                clean_all();
+                return;
             }
 
-            if(lstn->clnt_check > 0 && x509 != NULL && (bb = BIO_new(BIO_s_mem())) != NULL) {
-                X509_NAME_print_ex(bb, X509_get_subject_name(x509), 8, XN_FLAG_ONELINE & ~ASN1_STRFLGS_ESC_MSB);
-                get_line(bb, buf, MAXBUF);
-                if(BIO_printf(be, "X-SSL-Subject: %s\r\n", buf) <= 0) {
-                    str_be(buf, MAXBUF - 1, cur_backend);
-                    end_req = cur_time();
-                    logmsg(LOG_WARNING, "(%lx) e500 error write X-SSL-Subject to %s: %s (%.3f sec)",
-                        pthread_self(), buf, strerror(errno), (end_req - start_req) / 1000000.0);
-                    err_reply(cl, h500, lstn->err500);
-                    BIO_free_all(bb);
-                    clean_all();
-                    return;
-                }
-
-                X509_NAME_print_ex(bb, X509_get_issuer_name(x509), 8, XN_FLAG_ONELINE & ~ASN1_STRFLGS_ESC_MSB);
-                get_line(bb, buf, MAXBUF);
-                if(BIO_printf(be, "X-SSL-Issuer: %s\r\n", buf) <= 0) {
-                    str_be(buf, MAXBUF - 1, cur_backend);
-                    end_req = cur_time();
-                    logmsg(LOG_WARNING, "(%lx) e500 error write X-SSL-Issuer to %s: %s (%.3f sec)",
-                        pthread_self(), buf, strerror(errno), (end_req - start_req) / 1000000.0);
-                    err_reply(cl, h500, lstn->err500);
-                    BIO_free_all(bb);
-                    clean_all();
-                    return;
-                }
-
-                ASN1_TIME_print(bb, X509_get_notBefore(x509));
-                get_line(bb, buf, MAXBUF);
-                if(BIO_printf(be, "X-SSL-notBefore: %s\r\n", buf) <= 0) {
-                    str_be(buf, MAXBUF - 1, cur_backend);
-                    end_req = cur_time();
-                    logmsg(LOG_WARNING, "(%lx) e500 error write X-SSL-notBefore to %s: %s (%.3f sec)",
-                        pthread_self(), buf, strerror(errno), (end_req - start_req) / 1000000.0);
-                    err_reply(cl, h500, lstn->err500);
-                    BIO_free_all(bb);
-                    clean_all();
-                    return;
-                }
-
-                ASN1_TIME_print(bb, X509_get_notAfter(x509));
-                get_line(bb, buf, MAXBUF);
-                if(BIO_printf(be, "X-SSL-notAfter: %s\r\n", buf) <= 0) {
-                    str_be(buf, MAXBUF - 1, cur_backend);
-                    end_req = cur_time();
-                    logmsg(LOG_WARNING, "(%lx) e500 error write X-SSL-notAfter to %s: %s (%.3f sec)",
-                        pthread_self(), buf, strerror(errno), (end_req - start_req) / 1000000.0);
-                    err_reply(cl, h500, lstn->err500);
-                    BIO_free_all(bb);
-                    clean_all();
-                    return;
-                }
-                if(BIO_printf(be, "X-SSL-serial: %ld\r\n", ASN1_INTEGER_get(X509_get_serialNumber(x509))) <= 0) {
-                    str_be(buf, MAXBUF - 1, cur_backend);
-                    end_req = cur_time();
-                    logmsg(LOG_WARNING, "(%lx) e500 error write X-SSL-serial to %s: %s (%.3f sec)",
-                        pthread_self(), buf, strerror(errno), (end_req - start_req) / 1000000.0);
-                    err_reply(cl, h500, lstn->err500);
-                    BIO_free_all(bb);
-                    clean_all();
-                    return;
-                }
-                PEM_write_bio_X509(bb, x509);
-                get_line(bb, buf, MAXBUF);
-                if(BIO_printf(be, "X-SSL-certificate: %s", buf) <= 0) {
-                    str_be(buf, MAXBUF - 1, cur_backend);
-                    end_req = cur_time();
-                    logmsg(LOG_WARNING, "(%lx) e500 error write X-SSL-certificate to %s: %s (%.3f sec)",
-                        pthread_self(), buf, strerror(errno), (end_req - start_req) / 1000000.0);
-                    err_reply(cl, h500, lstn->err500);
-                    BIO_free_all(bb);
-                    clean_all();
-                    return;
-                }
-                while(get_line(bb, buf, MAXBUF) == 0) {
-                    if(BIO_printf(be, "%s", buf) <= 0) {
-                        str_be(buf, MAXBUF - 1, cur_backend);
-                        end_req = cur_time();
-                        logmsg(LOG_WARNING, "(%lx) e500 error write X-SSL-certificate to %s: %s (%.3f sec)",
-                            pthread_self(), buf, strerror(errno), (end_req - start_req) / 1000000.0);
-                        err_reply(cl, h500, lstn->err500);
-                        BIO_free_all(bb);
-                        clean_all();
-                        return;
-                    }
-                }
-                if(BIO_printf(be, "\r\n") <= 0) {
-                    str_be(buf, MAXBUF - 1, cur_backend);
-                    end_req = cur_time();
-                    logmsg(LOG_WARNING, "(%lx) e500 error write X-SSL-certificate to %s: %s (%.3f sec)",
-                        pthread_self(), buf, strerror(errno), (end_req - start_req) / 1000000.0);
-                    err_reply(cl, h500, lstn->err500);
-                    BIO_free_all(bb);
-                    clean_all();
-                    return;
-                }
-                BIO_free_all(bb);
+            /* request line, headers, AddHeader, X-SSL-*, X-Forwarded-For and the final CRLF in one write */
+            for(n_iov = tot = n = 0; n < n_hd; n++) {
+                if(!headers_ok[n])
+                    continue;
+                iov[n_iov].iov_base = HDR(headers, n);
+                iov[n_iov++].iov_len = headers->len[n];
+                iov[n_iov].iov_base = "\r\n";
+                iov[n_iov++].iov_len = 2;
+                tot += headers->len[n] + 2;
             }
-        }
-        /* put additional client IP header */
-        if(cur_backend->be_type == 0) {
-            addr2str(caddr, MAXBUF - 1, &from_host, 1);
-            BIO_printf(be, "X-Forwarded-For: %s\r\n", caddr);
-
-            /* final CRLF */
-            BIO_puts(be, "\r\n");
+            if(lstn->add_head != NULL) {
+                iov[n_iov].iov_base = lstn->add_head;
+                tot += iov[n_iov++].iov_len = strlen(lstn->add_head);
+                iov[n_iov].iov_base = "\r\n";
+                iov[n_iov++].iov_len = 2;
+                tot += 2;
+            }
+            if(ssl != NULL && conn->ssl_len > 0) {
+                iov[n_iov].iov_base = conn->ssl_head;
+                tot += iov[n_iov++].iov_len = conn->ssl_len;
+            }
+            iov[n_iov].iov_base = conn->fwd_head;
+            tot += iov[n_iov++].iov_len = conn->fwd_len;
+            if(send_iov(be, iov, n_iov, tot)) {
+                str_be(buf, MAXBUF - 1, cur_backend);
+                end_req = cur_time();
+                logmsg(LOG_WARNING, "(%lx) e500 error write headers to %s/%s: %s (%.3f sec)",
+                    pthread_self(), buf, request, strerror(errno),
+                    (end_req - start_req) / 1000000.0);
+                err_reply(cl, h500, lstn->err500);
+                clean_all();
+                return;
+            }
+            bc->n_req++;
         }
 
         if(cl_11 && chunked) {
@@ -1241,68 +1976,16 @@ do_http(thr_arg *arg)
                 return;
             }
         } else if(cont > 0L && is_readable(cl, lstn->to)) {
-            char one;
-            BIO  *cl_unbuf;
+            PUMP    rpc = { cl, be, "request body", &res_bytes, cont, L0 };
+
             /*
              * special mode for RPC_IN_DATA - content until EOF
              * force HTTP/1.0 - client closes connection when done.
              */
             cl_11 = be_11 = 0;
-
-            /*
-             * first read whatever is already in the input buffer
-             */
-            while(BIO_pending(cl)) {
-                if(BIO_read(cl, &one, 1) != 1) {
-                    logmsg(LOG_NOTICE, "(%lx) error read request pending: %s",
-                        pthread_self(), strerror(errno));
-                    clean_all();
-                    pthread_exit(NULL);
-                }
-                if (++res_bytes > cont) {
-                    logmsg(LOG_NOTICE, "(%lx) error read request pending: max. RPC length exceeded",
-                        pthread_self());
-                    clean_all();
-                    pthread_exit(NULL);
-                }
-                if(BIO_write(be, &one, 1) != 1) {
-                    if(errno)
-                        logmsg(LOG_NOTICE, "(%lx) error write request pending: %s",
-                            pthread_self(), strerror(errno));
-                    clean_all();
-                    pthread_exit(NULL);
-                }
-            }
-            BIO_flush(be);
-
-            /*
-             * find the socket BIO in the chain
-             */
-            if ((cl_unbuf = BIO_find_type(cl, lstn->ctx? BIO_TYPE_SSL : BIO_TYPE_SOCKET)) == NULL) {
-                 logmsg(LOG_WARNING, "(%lx) error get unbuffered: %s", pthread_self(), strerror(errno));
-                 clean_all();
-                 pthread_exit(NULL);
-            }
-
-            /*
-             * copy till EOF
-             */
-            while((res = BIO_read(cl_unbuf, buf, MAXBUF)) > 0) {
-                if((res_bytes += res) > cont) {
-                    logmsg(LOG_NOTICE, "(%lx) error copy request body: max. RPC length exceeded",
-                        pthread_self());
-                    clean_all();
-                    pthread_exit(NULL);
-                }
-                if(BIO_write(be, buf, res) != res) {
-                    if(errno)
-                        logmsg(LOG_NOTICE, "(%lx) error copy request body: %s",
-                            pthread_self(), strerror(errno));
-                    clean_all();
-                    pthread_exit(NULL);
-                } else {
-                    BIO_flush(be);
-                }
+            if(pump(&rpc, 1, -1)) {
+                clean_all();
+                return;
             }
         }
 
@@ -1417,10 +2100,12 @@ do_http(thr_arg *arg)
         }
 
         /* get the response */
+        start_be = cur_time();
         for(skip = 1; skip;) {
-            if((headers = get_headers(be, cl, lstn)) == NULL) {
+            if(get_headers(be, cl, lstn, headers)) {
                 str_be(buf, MAXBUF - 1, cur_backend);
                 end_req = cur_time();
+                upd_be(svc, cur_backend, end_req - start_be, 0);
                 addr2str(caddr, MAXBUF - 1, &from_host, 1);
                 logmsg(LOG_NOTICE, "(%lx) e500 for %s response error read from %s/%s: %s (%.3f secs)",
                     pthread_self(), caddr, buf, request, strerror(errno), (end_req - start_req) / 1000000.0);
@@ -1429,7 +2114,7 @@ do_http(thr_arg *arg)
                 return;
             }
 
-            strncpy(response, headers[0], MAXBUF);
+            strncpy(response, HDR(headers, 0), MAXBUF);
             be_11 = (response[7] == '1');
             /* responses with code 100 are never passed back to the client */
             skip = !regexec(&RESP_SKIP, response, 0, NULL, 0);
@@ -1438,9 +2123,11 @@ do_http(thr_arg *arg)
                 no_cont = 1;
             if(!strncasecmp("101", response + 9, 3))
                 is_ws |= WSS_RESP_101;
+            if(!skip)
+                upd_be(svc, cur_backend, cur_time() - start_be, atoi(response + 9));
 
-            for(chunked = 0, cont = -1L, n = 1; n < MAXHEADERS && headers[n]; n++) {
-                switch(check_header(headers[n], buf)) {
+            for(chunked = 0, cont = -1L, n = 1; n < headers->n; n++) {
+                switch(check_header(HDR(headers, n), buf)) {
                 case HEADER_CONNECTION:
                     if(!strcasecmp("close", buf))
                         conn_closed = 1;
@@ -1472,11 +2159,9 @@ do_http(thr_arg *arg)
                     if(v_host[0] && need_rewrite(lstn->rewr_loc, buf, loc_path, v_host, lstn, cur_backend)) {
                         snprintf(buf, MAXBUF, "Location: %s://%s/%s",
                             (ssl == NULL? "http": "https"), v_host, loc_path);
-                        free(headers[n]);
-                        if((headers[n] = strdup(buf)) == NULL) {
+                        if(hdr_set(headers, n, buf)) {
                             logmsg(LOG_WARNING, "(%lx) rewrite Location - out of memory: %s",
                                 pthread_self(), strerror(errno));
-                            free_headers(headers);
                             clean_all();
                             return;
                         }
@@ -1486,11 +2171,9 @@ do_http(thr_arg *arg)
                     if(v_host[0] && need_rewrite(lstn->rewr_loc, buf, loc_path, v_host, lstn, cur_backend)) {
                         snprintf(buf, MAXBUF, "Content-location: %s://%s/%s",
                             (ssl == NULL? "http": "https"), v_host, loc_path);
-                        free(headers[n]);
-                        if((headers[n] = strdup(buf)) == NULL) {
+                        if(hdr_set(headers, n, buf)) {
                             logmsg(LOG_WARNING, "(%lx) rewrite Content-location - out of memory: %s",
                                 pthread_self(), strerror(errno));
-                            free_headers(headers);
                             clean_all();
                             return;
                         }
@@ -1500,22 +2183,20 @@ do_http(thr_arg *arg)
             }
 
             /* possibly record session information (only for cookies/header) */
-            upd_session(svc, &headers[1], cur_backend);
+            upd_session(svc, headers, cur_backend);
 
             /* send the response */
             if(!skip)
-                for(n = 0; n < MAXHEADERS && headers[n]; n++) {
-                    if(BIO_printf(cl, "%s\r\n", headers[n]) <= 0) {
+                for(n = 0; n < headers->n; n++) {
+                    if(BIO_write(cl, HDR(headers, n), headers->len[n]) != headers->len[n] || BIO_write(cl, "\r\n", 2) != 2) {
                         if(errno) {
                             addr2str(caddr, MAXBUF - 1, &from_host, 1);
                             logmsg(LOG_NOTICE, "(%lx) error write to %s: %s", pthread_self(), caddr, strerror(errno));
                         }
-                        free_headers(headers);
                         clean_all();
                         return;
                     }
                 }
-            free_headers(headers);
 
             /* final CRLF */
             if(!skip)
@@ -1548,58 +2229,24 @@ do_http(thr_arg *arg)
                     }
                 } else if(!skip) {
                     if(is_readable(be, cur_backend->to)) {
-                        char    one;
-                        BIO     *be_unbuf;
+                        PUMP    eof = { be, cl, "response body", &res_bytes, L_1, L0 };
+
                         /*
                          * old-style response - content until EOF
                          * also implies the client may not use HTTP/1.1
                          */
                         cl_11 = be_11 = 0;
 
-                        /*
-                         * first read whatever is already in the input buffer
-                         */
-                        while(BIO_pending(be)) {
-                            if(BIO_read(be, &one, 1) != 1) {
-                                logmsg(LOG_NOTICE, "(%lx) error read response pending: %s",
+                        /* plain sockets both ways: splice till EOF */
+                        if((res = splice_bin(be, cl, L_1, &res_bytes)) < -1) {
+                            if(errno)
+                                logmsg(LOG_NOTICE, "(%lx) error copy response body: %s",
                                     pthread_self(), strerror(errno));
-                                clean_all();
-                                return;
-                            }
-                            if(BIO_write(cl, &one, 1) != 1) {
-                                if(errno)
-                                    logmsg(LOG_NOTICE, "(%lx) error write response pending: %s",
-                                        pthread_self(), strerror(errno));
-                                clean_all();
-                                return;
-                            }
-                            res_bytes++;
-                        }
-                        BIO_flush(cl);
-
-                        /*
-                         * find the socket BIO in the chain
-                         */
-                        if((be_unbuf = BIO_find_type(be, cur_backend->ctx? BIO_TYPE_SSL : BIO_TYPE_SOCKET)) == NULL) {
-                            logmsg(LOG_WARNING, "(%lx) error get unbuffered: %s", pthread_self(), strerror(errno));
                             clean_all();
                             return;
-                        }
-
-                        /*
-                         * copy till EOF
-                         */
-                        while((res = BIO_read(be_unbuf, buf, MAXBUF)) > 0) {
-                            if(BIO_write(cl, buf, res) != res) {
-                                if(errno)
-                                    logmsg(LOG_NOTICE, "(%lx) error copy response body: %s",
-                                        pthread_self(), strerror(errno));
-                                clean_all();
-                                return;
-                            } else {
-                                res_bytes += res;
-                                BIO_flush(cl);
-                            }
+                        } else if(res > 0 && pump(&eof, 1, -1)) {
+                            clean_all();
+                            return;
                         }
                     }
                 }
@@ -1618,109 +2265,15 @@ do_http(thr_arg *arg)
                 /*
                  * special mode for Websockets - content until EOF
                  */
-                char one;
-                BIO  *cl_unbuf;
-                BIO  *be_unbuf;
-                struct pollfd p[2];
+                PUMP    ws[2] = {
+                    { cl, be, "ws request body", NULL, L_1, L0 },
+                    { be, cl, "ws response body", &res_bytes, L_1, L0 },
+                };
 
                 cl_11 = be_11 = 0;
-
-                memset(p, 0, sizeof(p));
-                BIO_get_fd(cl, &p[0].fd);
-                p[0].events = POLLIN | POLLPRI;
-                BIO_get_fd(be, &p[1].fd);
-                p[1].events = POLLIN | POLLPRI;
-
-                while (BIO_pending(cl) || BIO_pending(be) || poll(p, 2, cur_backend->ws_to * 1000) > 0) {
-
-                    /*
-                     * first read whatever is already in the input buffer
-                     */
-                    while(BIO_pending(cl)) {
-                        if(BIO_read(cl, &one, 1) != 1) {
-                            logmsg(LOG_NOTICE, "(%lx) error read ws request pending: %s",
-                                pthread_self(), strerror(errno));
-                            clean_all();
-                            return;
-                        }
-                        if(BIO_write(be, &one, 1) != 1) {
-                            if(errno)
-                                logmsg(LOG_NOTICE, "(%lx) error write ws request pending: %s",
-                                    pthread_self(), strerror(errno));
-                            clean_all();
-                            return;
-                        }
-                    }
-                    BIO_flush(be);
-
-                    while(BIO_pending(be)) {
-                        if(BIO_read(be, &one, 1) != 1) {
-                            logmsg(LOG_NOTICE, "(%lx) error read ws response pending: %s",
-                                pthread_self(), strerror(errno));
-                            clean_all();
-                            return;
-                        }
-                        if(BIO_write(cl, &one, 1) != 1) {
-                            if(errno)
-                                logmsg(LOG_NOTICE, "(%lx) error write ws response pending: %s",
-                                    pthread_self(), strerror(errno));
-                            clean_all();
-                            return;
-                        }
-                        res_bytes++;
-                    }
-                    BIO_flush(cl);
-
-                    /*
-                     * find the socket BIO in the chain
-                     */
-                    if ((cl_unbuf = BIO_find_type(cl, lstn->ctx? BIO_TYPE_SSL : BIO_TYPE_SOCKET)) == NULL) {
-                         logmsg(LOG_WARNING, "(%lx) error get unbuffered: %s", pthread_self(), strerror(errno));
-                         clean_all();
-                         return;
-                    }
-                    if((be_unbuf = BIO_find_type(be, cur_backend->ctx? BIO_TYPE_SSL : BIO_TYPE_SOCKET)) == NULL) {
-                        logmsg(LOG_WARNING, "(%lx) error get unbuffered: %s", pthread_self(), strerror(errno));
-                        clean_all();
-                        return;
-                    }
-
-                    /*
-                     * copy till EOF
-                     */
-                    if(p[0].revents) {
-                        res = BIO_read(cl_unbuf, buf, MAXBUF);
-                        if(res <= 0) {
-                            break;
-                        }
-                        if(BIO_write(be, buf, res) != res) {
-                            if(errno)
-                                logmsg(LOG_NOTICE, "(%lx) error copy ws request body: %s",
-                                    pthread_self(), strerror(errno));
-                            clean_all();
-                            return;
-                        } else {
-                            BIO_flush(be);
-                        }
-                        p[0].revents = 0;
-                    }
-                    if(p[1].revents) {
-                        res = BIO_read(be_unbuf, buf, MAXBUF);
-                        if(res <= 0) {
-                            break;
-                        }
-                        if(BIO_write(cl, buf, res) != res) {
-                            if(errno)
-                                logmsg(LOG_NOTICE, "(%lx) error copy ws response body: %s",
-                                    pthread_self(), strerror(errno));
-                            clean_all();
-                            return;
-                        } else {
-                            res_bytes += res;
-                            BIO_flush(cl);
-                        }
-                        p[1].revents = 0;
-                    }
+                if(pump(ws, 2, cur_backend->ws_to * 1000)) {
+                    clean_all();
+                    return;
                 }
             }
         }
@@ -1774,8 +2327,16 @@ do_http(thr_arg *arg)
         }
 
         if(!be_11) {
-            BIO_reset(be);
-            BIO_free_all(be);
+            be_free(bc);
+            bc = NULL;
+            be = NULL;
+        } else if(cur_backend->pool_max > 0) {
+            /* complete response: the connection goes back to the pool unless either side closes it */
+            if(cl_11 && !conn_closed)
+                be_put(cur_backend, bc);
+            else
+                be_free(bc);
+            bc = NULL;
             be = NULL;
         }
         /*
@@ -1803,11 +2364,9 @@ do_http(thr_arg *arg)
 void *
 thr_http(void *dummy)
 {
-    thr_arg *arg;
+    thr_arg arg;
 
-    for(;;) {
-        while((arg = get_thr_arg()) == NULL)
-            logmsg(LOG_NOTICE, "NULL get_thr_arg");
-        do_http(arg);
-    }
+    while(!get_thr_arg(&arg))
+        do_http(&arg);
+    return NULL;
 }
@@ -0,0 +1,422 @@
+/*
+ * Pound - the reverse-proxy load-balancer
+ * Copyright (C) 2002-2010 Apsis GmbH
+ *
+ * This file is part of Pound.
+ *
+ * Pound is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Pound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Contact information:
+ * Apsis GmbH
+ * P.O.Box
+ * 8707 Uetikon am See
+ * Switzerland
+ * EMail: roseg@apsis.ch
+ */
+
+
+/*
+ * The line buffer
+ *
+ * A filter BIO that takes the place of BIO_f_buffer on client and back-end
+ * connections. Input is read in large blocks, one read at a time (BIO_f_buffer
+ * insists on filling the whole request, which would block on a keep-alive
+ * connection), and lb_get_line() takes whole lines straight out of the buffer,
+ * looking for the end of line and for illegal characters 16 or 32 bytes at a
+ * time where SSE2/AVX2 are available. Output is buffered until flushed, as
+ * before.
+ */
+
+#include    "pound.h"
+
+#if defined(__AVX2__)
+#include    <immintrin.h>
+#elif defined(__SSE2__)
+#include    <emmintrin.h>
+#endif
+
+#define LB_RSIZE    (16 * 1024)     /* input buffer: one TLS record fits */
+#define LB_WSIZE    MAXBUF          /* output buffer */
+
+typedef struct {
+    int             rpos, rlen;     /* unread input is rbuf[rpos .. rlen - 1] */
+    int             wlen;           /* pending output */
+    unsigned char   rbuf[LB_RSIZE];
+    unsigned char   wbuf[LB_WSIZE];
+}   LB_CTX;
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define BIO_get_data(b)     ((b)->ptr)
+#define BIO_set_data(b, p)  ((b)->ptr = (p))
+#define BIO_set_init(b, i)  ((b)->init = (i))
+#define BIO_next(b)         ((b)->next_bio)
+typedef bio_info_cb         BIO_info_cb;
+#endif
+
+/*
+ * find the first byte in p[0 .. n - 1] that may not appear within a line: a control
+ * character other than TAB (this includes CR and LF) or DEL
+ * returns n if there is none
+ */
+static int
+lb_scan(const unsigned char *p, const int n)
+{
+    int i;
+
+    i = 0;
+#if defined(__AVX2__)
+    {
+        const __m256i   ctl = _mm256_set1_epi8(0x1f), tab = _mm256_set1_epi8('\t'), del = _mm256_set1_epi8(0x7f);
+        __m256i         v, bad;
+        unsigned int    mask;
+
+        for(; i + 32 <= n; i += 32) {
+            v = _mm256_loadu_si256((const __m256i *)(p + i));
+            /* unsigned v <= 0x1f is min(v, 0x1f) == v */
+            bad = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, tab), _mm256_cmpeq_epi8(_mm256_min_epu8(v, ctl), v));
+            bad = _mm256_or_si256(bad, _mm256_cmpeq_epi8(v, del));
+            if((mask = (unsigned int)_mm256_movemask_epi8(bad)) != 0)
+                return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    {
+        const __m128i   ctl = _mm_set1_epi8(0x1f), tab = _mm_set1_epi8('\t'), del = _mm_set1_epi8(0x7f);
+        __m128i         v, bad;
+        unsigned int    mask;
+
+        for(; i + 16 <= n; i += 16) {
+            v = _mm_loadu_si128((const __m128i *)(p + i));
+            bad = _mm_andnot_si128(_mm_cmpeq_epi8(v, tab), _mm_cmpeq_epi8(_mm_min_epu8(v, ctl), v));
+            bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, del));
+            if((mask = (unsigned int)_mm_movemask_epi8(bad)) != 0)
+                return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for(; i < n; i++)
+        if((p[i] < 0x20 && p[i] != '\t') || p[i] == 0x7f)
+            return i;
+    return n;
+}
+
+/*
+ * refill the (empty) input buffer with a single read
+ */
+static int
+lb_fill(BIO *const b, LB_CTX *const ctx)
+{
+    int res;
+
+    ctx->rpos = ctx->rlen = 0;
+    if((res = BIO_read(BIO_next(b), ctx->rbuf, LB_RSIZE)) <= 0) {
+        BIO_copy_next_retry(b);
+        return res;
+    }
+    ctx->rlen = res;
+    return res;
+}
+
+/*
+ * write out the pending output
+ */
+static int
+lb_drain(BIO *const b, LB_CTX *const ctx)
+{
+    int done, res;
+
+    for(done = 0; done < ctx->wlen; done += res)
+        if((res = BIO_write(BIO_next(b), ctx->wbuf + done, ctx->wlen - done)) <= 0) {
+            BIO_copy_next_retry(b);
+            memmove(ctx->wbuf, ctx->wbuf + done, ctx->wlen - done);
+            ctx->wlen -= done;
+            return res;
+        }
+    ctx->wlen = 0;
+    return 1;
+}
+
+static int
+lb_read(BIO *b, char *out, int outl)
+{
+    LB_CTX  *ctx;
+    int     res;
+
+    if(out == NULL || outl <= 0 || (ctx = (LB_CTX *)BIO_get_data(b)) == NULL || BIO_next(b) == NULL)
+        return 0;
+    BIO_clear_retry_flags(b);
+    if(ctx->rpos >= ctx->rlen) {
+        if(outl >= LB_RSIZE) {
+            /* large reads go straight through */
+            if((res = BIO_read(BIO_next(b), out, outl)) <= 0)
+                BIO_copy_next_retry(b);
+            return res;
+        }
+        if((res = lb_fill(b, ctx)) <= 0)
+            return res;
+    }
+    if(outl > ctx->rlen - ctx->rpos)
+        outl = ctx->rlen - ctx->rpos;
+    memcpy(out, ctx->rbuf + ctx->rpos, outl);
+    ctx->rpos += outl;
+    return outl;
+}
+
+static int
+lb_write(BIO *b, const char *in, int inl)
+{
+    LB_CTX  *ctx;
+    int     done, res;
+
+    if(in == NULL || inl <= 0 || (ctx = (LB_CTX *)BIO_get_data(b)) == NULL || BIO_next(b) == NULL)
+        return 0;
+    BIO_clear_retry_flags(b);
+    if(ctx->wlen + inl > LB_WSIZE && (res = lb_drain(b, ctx)) <= 0)
+        return res;
+    if(inl < LB_WSIZE) {
+        memcpy(ctx->wbuf + ctx->wlen, in, inl);
+        ctx->wlen += inl;
+        return inl;
+    }
+    /* too large to be worth buffering */
+    for(done = 0; done < inl; done += res)
+        if((res = BIO_write(BIO_next(b), in + done, inl - done)) <= 0) {
+            BIO_copy_next_retry(b);
+            return done > 0? done: res;
+        }
+    return inl;
+}
+
+static int
+lb_puts(BIO *b, const char *str)
+{
+    return lb_write(b, str, strlen(str));
+}
+
+static long
+lb_ctrl(BIO *b, int cmd, long num, void *ptr)
+{
+    LB_CTX  *ctx;
+    long    res;
+
+    ctx = (LB_CTX *)BIO_get_data(b);
+    if(BIO_next(b) == NULL)
+        return 0;
+    switch(cmd) {
+    case BIO_CTRL_RESET:
+        ctx->rpos = ctx->rlen = ctx->wlen = 0;
+        return BIO_ctrl(BIO_next(b), cmd, num, ptr);
+    case BIO_CTRL_PENDING:
+        return (ctx->rlen - ctx->rpos) + BIO_ctrl(BIO_next(b), cmd, num, ptr);
+    case BIO_CTRL_WPENDING:
+        return ctx->wlen + BIO_ctrl(BIO_next(b), cmd, num, ptr);
+    case BIO_CTRL_FLUSH:
+        BIO_clear_retry_flags(b);
+        if((res = lb_drain(b, ctx)) <= 0)
+            return res;
+        res = BIO_ctrl(BIO_next(b), cmd, num, ptr);
+        BIO_copy_next_retry(b);
+        return res;
+    case BIO_C_DO_STATE_MACHINE:
+        BIO_clear_retry_flags(b);
+        res = BIO_ctrl(BIO_next(b), cmd, num, ptr);
+        BIO_copy_next_retry(b);
+        return res;
+    case BIO_CTRL_DUP:
+        return 0;
+    default:
+        return BIO_ctrl(BIO_next(b), cmd, num, ptr);
+    }
+}
+
+static long
+lb_callback_ctrl(BIO *b, int cmd, BIO_info_cb *fp)
+{
+    return BIO_next(b) == NULL? 0: BIO_callback_ctrl(BIO_next(b), cmd, fp);
+}
+
+static int
+lb_new(BIO *b)
+{
+    LB_CTX  *ctx;
+
+    if((ctx = (LB_CTX *)malloc(sizeof(LB_CTX))) == NULL)
+        return 0;
+    ctx->rpos = ctx->rlen = ctx->wlen = 0;
+    BIO_set_data(b, ctx);
+    BIO_set_init(b, 1);
+    return 1;
+}
+
+static int
+lb_free(BIO *b)
+{
+    if(b == NULL)
+        return 0;
+    free(BIO_get_data(b));
+    BIO_set_data(b, NULL);
+    BIO_set_init(b, 0);
+    return 1;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+static BIO_METHOD   *lb_method = NULL;
+static int          lb_type = -1;
+#else
+static int          lb_type = BIO_TYPE_FILTER | 0x7f;
+static BIO_METHOD   lb_method_s = {
+    BIO_TYPE_FILTER | 0x7f,
+    "line buffer",
+    lb_write,
+    lb_read,
+    lb_puts,
+    NULL,
+    lb_ctrl,
+    lb_new,
+    lb_free,
+    lb_callback_ctrl,
+};
+static BIO_METHOD   *lb_method = &lb_method_s;
+#endif
+
+/*
+ * set up the line buffer BIO type - called once, before the threads are started
+ */
+void
+init_linebuf(void)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    lb_type = BIO_get_new_index() | BIO_TYPE_FILTER;
+    if((lb_method = BIO_meth_new(lb_type, "line buffer")) == NULL
+    || !BIO_meth_set_write(lb_method, lb_write)
+    || !BIO_meth_set_read(lb_method, lb_read)
+    || !BIO_meth_set_puts(lb_method, lb_puts)
+    || !BIO_meth_set_ctrl(lb_method, lb_ctrl)
+    || !BIO_meth_set_callback_ctrl(lb_method, lb_callback_ctrl)
+    || !BIO_meth_set_create(lb_method, lb_new)
+    || !BIO_meth_set_destroy(lb_method, lb_free)) {
+        logmsg(LOG_ERR, "init_linebuf: can't create the BIO method - aborted");
+        exit(1);
+    }
+#endif
+    return;
+}
+
+/*
+ * a new line buffer BIO - to be pushed on top of a connection
+ */
+BIO *
+BIO_new_linebuf(void)
+{
+    return BIO_new(lb_method);
+}
+
+/*
+ * look at the buffered input of a line buffer without copying it (refilling it if empty)
+ * returns the number of bytes available at *data, 0 on EOF, < 0 on error
+ * and -2 if b is not a line buffer; lb_consume() then takes them out
+ */
+int
+lb_peek(BIO *const b, const char **data)
+{
+    LB_CTX  *ctx;
+    int     res;
+
+    if(BIO_method_type(b) != lb_type || (ctx = (LB_CTX *)BIO_get_data(b)) == NULL)
+        return -2;
+    BIO_clear_retry_flags(b);
+    if(ctx->rpos >= ctx->rlen && (res = lb_fill(b, ctx)) <= 0)
+        return res < 0? -1: 0;
+    *data = (const char *)ctx->rbuf + ctx->rpos;
+    return ctx->rlen - ctx->rpos;
+}
+
+void
+lb_consume(BIO *const b, const int n)
+{
+    LB_CTX  *ctx;
+
+    if((ctx = (LB_CTX *)BIO_get_data(b)) != NULL)
+        ctx->rpos += n;
+}
+
+/*
+ * skip the input up to and including the next NL
+ */
+static int
+lb_skip(BIO *const b, LB_CTX *const ctx)
+{
+    unsigned char   *nl;
+
+    for(;;) {
+        if(ctx->rpos >= ctx->rlen && lb_fill(b, ctx) <= 0)
+            return 1;
+        if((nl = memchr(ctx->rbuf + ctx->rpos, '\n', ctx->rlen - ctx->rpos)) != NULL) {
+            ctx->rpos = nl - ctx->rbuf + 1;
+            return 1;
+        }
+        ctx->rpos = ctx->rlen;
+    }
+}
+
+/*
+ * get_line() for a line buffer BIO, with the same rules: the line ends in CRLF or a
+ * bare LF, which are stripped; a CR not followed by LF, any other control character
+ * or a line that does not fit in bufsize - 1 bytes (CR included) make it fail
+ * (returns 1) after skipping the input up to the next LF, as does EOF
+ * returns -1 if b is not a line buffer, 0 on success
+ */
+int
+lb_get_line(BIO *const b, char *const buf, const int bufsize)
+{
+    LB_CTX          *ctx;
+    unsigned char   c;
+    int             i, n, k;
+
+    if(BIO_method_type(b) != lb_type || (ctx = (LB_CTX *)BIO_get_data(b)) == NULL)
+        return -1;
+    for(i = 0;;) {
+        buf[i] = '\0';
+        if(ctx->rpos >= ctx->rlen && lb_fill(b, ctx) <= 0)
+            return 1;
+        if((n = ctx->rlen - ctx->rpos) > bufsize - 1 - i)
+            n = bufsize - 1 - i;
+        k = lb_scan(ctx->rbuf + ctx->rpos, n);
+        memcpy(buf + i, ctx->rbuf + ctx->rpos, k);
+        i += k;
+        ctx->rpos += k;
+        buf[i] = '\0';
+        if(k == n) {
+            if(i >= bufsize - 1)
+                /* line too long */
+                return lb_skip(b, ctx);
+            continue;
+        }
+        c = ctx->rbuf[ctx->rpos++];
+        if(c == '\n')
+            /* line ends in NL only (no CR) */
+            return 0;
+        if(c != '\r' || ++i >= bufsize - 1)
+            /* other control characters, or no room left for the NL */
+            return lb_skip(b, ctx);
+        if(ctx->rpos >= ctx->rlen && lb_fill(b, ctx) <= 0)
+            return 1;
+        if(ctx->rbuf[ctx->rpos] != '\n')
+            /* we have CR not followed by NL */
+            return lb_skip(b, ctx);
+        ctx->rpos++;
+        return 0;
+    }
+}
@@ -25,8 +25,8 @@
  * EMail: roseg@apsis.ch
  */
 
-#include <dlfcn.h>
 #include    "pound.h"
+#include <dlfcn.h>
 
 /* common variables */
 char        *user,              /* user to run as */
@@ -41,7 +41,11 @@ int         alive_to,           /* check interval for resurrection */
             log_facility,       /* log facility to use */
             print_log,          /* print log messages to stdout/stderr */
             grace,              /* grace period before shutdown */
-            control_sock;       /* control socket */
+            control_sock,       /* control socket */
+            ev_threads,         /* number of event threads (0: no event engine) */
+            park_idle,          /* no event threads: idle workers poll the parked connections */
+            acceptors,          /* number of acceptor threads (0: accept in the main thread) */
+            relay_flush;        /* relays (RPC, WebSocket, content until EOF) flush after every read */
 
 SERVICE     *services;          /* global services (if any) */
 
@@ -50,13 +54,10 @@ LISTENER    *listeners;         /* all available listeners */
 PLUGIN      *plugins;
 
 
-regex_t HEADER,             /* Allowed header */
-        CONN_UPGRD,         /* upgrade in connection header */
-        CHUNK_HEAD,         /* chunk header line */
+regex_t CONN_UPGRD,         /* upgrade in connection header */
         RESP_SKIP,          /* responses for which we skip response */
         RESP_IGN,           /* responses for which we ignore content */
-        LOCATION,           /* the host we are redirected to */
-        AUTHORIZATION;      /* the Authorisation header */
+        LOCATION;           /* the host we are redirected to */
 
 static int  shut_down = 0;
 
@@ -116,64 +117,337 @@ l_id(void)
 
 /*
  * work queue stuff
+ *
+ * A bounded lock-free multi-producer/multi-consumer ring (D. Vyukov's design):
+ * each cell carries a sequence number that tells whether it is free for the
+ * producer of the current round or holds an entry for its consumer. Producers
+ * and consumers only contend on their own position counter, which sit on
+ * separate cache lines. Idle workers sleep on an event count - a futex where
+ * available, a condition variable otherwise.
+ *
+ * The pool of workers is adaptive: it starts with min_threads workers and
+ * starts more (up to max_threads) when requests pile up in the queue or wait
+ * in it for too long; a worker that finds no work for thread_idle seconds
+ * retires, unless the pool is down to min_threads.
  */
-static thr_arg          *first = NULL, *last = NULL;
+#define CACHE_LINE  64
+
+typedef union {
+    struct {
+        unsigned long   seq;
+        thr_arg         arg;
+    }       c;
+    char    pad[((sizeof(unsigned long) + sizeof(thr_arg) + CACHE_LINE - 1) / CACHE_LINE) * CACHE_LINE];
+}   Q_CELL;
+
+static struct {
+    char            pad0[CACHE_LINE];
+    unsigned long   head;               /* next cell to consume */
+    char            pad1[CACHE_LINE - sizeof(unsigned long)];
+    unsigned long   tail;               /* next cell to produce */
+    char            pad2[CACHE_LINE - sizeof(unsigned long)];
+    unsigned int    ev_seq;             /* event count the idle workers wait on */
+    int             n_wait;             /* number of idle workers */
+    char            pad3[CACHE_LINE];
+}   q;
+
+static Q_CELL           *q_cells = NULL;
+static unsigned long    q_mask;
+
+static struct {
+    int             threads;            /* running workers */
+    int             spawning;           /* a worker is being started */
+    unsigned long   spawned, retired;   /* workers started/retired so far */
+    time_t          last_spawn, last_retire;
+}   pool;
+
+static pthread_attr_t   pool_attr;
+
+int                     numthreads,
+                        queue_size,
+                        min_threads,
+                        max_threads,
+                        thread_idle,
+                        spawn_queue,
+                        spawn_wait;
+
+#if !HAVE_LINUX_FUTEX_H
 static pthread_cond_t   arg_cond;
 static pthread_mutex_t  arg_mut;
-int                     numthreads;
+#endif
 
+/*
+ * allocate the queue - queue_size is rounded up to a power of 2
+ */
 static void
 init_thr_arg(void)
 {
+    unsigned long   n, i;
+
+    for(n = 2; n < queue_size; n <<= 1)
+        ;
+    if(posix_memalign((void **)&q_cells, CACHE_LINE, n * sizeof(Q_CELL))) {
+        logmsg(LOG_ERR, "Out of memory for the work queue - aborted");
+        exit(1);
+    }
+    for(i = 0; i < n; i++)
+        q_cells[i].c.seq = i;
+    q_mask = n - 1;
+    q.head = q.tail = 0;
+#if !HAVE_LINUX_FUTEX_H
     pthread_cond_init(&arg_cond, NULL);
     pthread_mutex_init(&arg_mut, NULL);
+#endif
+
+    memset(&pool, 0, sizeof(pool));
+    pthread_attr_init(&pool_attr);
+    pthread_attr_setdetachstate(&pool_attr, PTHREAD_CREATE_DETACHED);
+#ifdef  NEED_STACK
+    /* set new stack size - necessary for OpenBSD/FreeBSD and Linux NPTL */
+    if(pthread_attr_setstacksize(&pool_attr, 1 << 18)) {
+        logmsg(LOG_ERR, "can't set stack size - aborted");
+        exit(1);
+    }
+#endif
     return;
 }
 
 /*
- * add a request to the queue
+ * monotonic time in milliseconds
  */
-int
-put_thr_arg(thr_arg *arg)
+unsigned long
+mono_ms(void)
 {
-    thr_arg *res;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-    if((res = malloc(sizeof(thr_arg))) == NULL) {
-        logmsg(LOG_WARNING, "thr_arg malloc");
+/*
+ * sleep until the event count moves away from seq, or for at most to seconds (if > 0)
+ * returns -1 on time-out
+ */
+static int
+q_wait(const unsigned int seq, const int to)
+{
+    struct timespec ts;
+#if HAVE_LINUX_FUTEX_H
+
+    ts.tv_sec = to;
+    ts.tv_nsec = 0;
+    if(syscall(SYS_futex, &q.ev_seq, FUTEX_WAIT_PRIVATE, seq, to > 0? &ts: NULL, NULL, 0) < 0 && errno == ETIMEDOUT)
         return -1;
-    }
-    memcpy(res, arg, sizeof(thr_arg));
-    res->next = NULL;
+    return 0;
+#else
+    int res;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += to;
     (void)pthread_mutex_lock(&arg_mut);
-    if(last == NULL)
-        first = last = res;
-    else {
-        last->next = res;
-        last = last->next;
-    }
+    for(res = 0; __atomic_load_n(&q.ev_seq, __ATOMIC_SEQ_CST) == seq && res != ETIMEDOUT; )
+        res = to > 0? pthread_cond_timedwait(&arg_cond, &arg_mut, &ts): pthread_cond_wait(&arg_cond, &arg_mut);
+    res = __atomic_load_n(&q.ev_seq, __ATOMIC_SEQ_CST) == seq? -1: 0;
     (void)pthread_mutex_unlock(&arg_mut);
-    pthread_cond_signal(&arg_cond);
+    return res;
+#endif
+}
+
+/*
+ * start a worker thread
+ */
+static int
+start_worker(void)
+{
+    pthread_t   thr;
+
+    __atomic_add_fetch(&pool.threads, 1, __ATOMIC_SEQ_CST);
+    if(pthread_create(&thr, &pool_attr, thr_http, NULL)) {
+        __atomic_sub_fetch(&pool.threads, 1, __ATOMIC_SEQ_CST);
+        logmsg(LOG_ERR, "create thr_http: %s", strerror(errno));
+        return -1;
+    }
     return 0;
 }
 
 /*
- * get a request from the queue
+ * the queue is under pressure - add a worker, one at a time and up to max_threads
+ */
+static void
+grow_pool(const char *why)
+{
+    int n;
+
+    if(__atomic_exchange_n(&pool.spawning, 1, __ATOMIC_ACQ_REL))
+        return;
+    if((n = __atomic_load_n(&pool.threads, __ATOMIC_SEQ_CST)) < max_threads && !start_worker()) {
+        __atomic_add_fetch(&pool.spawned, 1, __ATOMIC_RELAXED);
+        pool.last_spawn = time(NULL);
+        logmsg(LOG_INFO, "worker pool: started a thread (%s), %d running", why, n + 1);
+    }
+    __atomic_store_n(&pool.spawning, 0, __ATOMIC_RELEASE);
+    return;
+}
+
+/*
+ * a worker has been idle for thread_idle seconds - let it go if the pool is above min_threads
  */
-thr_arg *
-get_thr_arg(void)
+static int
+retire_worker(void)
 {
-    thr_arg *res;
+    int n;
+
+    n = __atomic_load_n(&pool.threads, __ATOMIC_SEQ_CST);
+    while(n > min_threads)
+        if(__atomic_compare_exchange_n(&pool.threads, &n, n - 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+            __atomic_add_fetch(&pool.retired, 1, __ATOMIC_RELAXED);
+            pool.last_retire = time(NULL);
+            logmsg(LOG_INFO, "worker pool: retired an idle thread, %d running", n - 1);
+            return 1;
+        }
+    return 0;
+}
 
+/*
+ * wake up one idle worker (if any)
+ */
+static void
+q_wake(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&q.n_wait, __ATOMIC_SEQ_CST) <= 0) {
+        /* nobody waiting on the queue - maybe a worker polling parked connections */
+        ev_wake();
+        return;
+    }
+#if HAVE_LINUX_FUTEX_H
+    __atomic_add_fetch(&q.ev_seq, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &q.ev_seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
     (void)pthread_mutex_lock(&arg_mut);
-    if(first == NULL)
-        (void)pthread_cond_wait(&arg_cond, &arg_mut);
-    if((res = first) != NULL)
-        if((first = first->next) == NULL)
-            last = NULL;
+    __atomic_add_fetch(&q.ev_seq, 1, __ATOMIC_SEQ_CST);
     (void)pthread_mutex_unlock(&arg_mut);
-    if(first != NULL)
-        pthread_cond_signal(&arg_cond);
-    return res;
+    pthread_cond_signal(&arg_cond);
+#endif
+    return;
+}
+
+/*
+ * take an entry off the queue without waiting - returns -1 if empty
+ */
+static int
+q_pop(thr_arg *arg)
+{
+    Q_CELL          *cell;
+    unsigned long   pos, seq;
+    long            dif;
+
+    pos = __atomic_load_n(&q.head, __ATOMIC_RELAXED);
+    for(;;) {
+        cell = &q_cells[pos & q_mask];
+        seq = __atomic_load_n(&cell->c.seq, __ATOMIC_ACQUIRE);
+        if((dif = (long)(seq - (pos + 1))) == 0) {
+            if(__atomic_compare_exchange_n(&q.head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if(dif < 0)
+            return -1;
+        else
+            pos = __atomic_load_n(&q.head, __ATOMIC_RELAXED);
+    }
+    memcpy(arg, &cell->c.arg, sizeof(thr_arg));
+    __atomic_store_n(&cell->c.seq, pos + q_mask + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * add a request to the queue - returns -1 if the queue is full
+ */
+int
+put_thr_arg(thr_arg *arg)
+{
+    Q_CELL          *cell;
+    unsigned long   pos, seq;
+    long            dif;
+
+    pos = __atomic_load_n(&q.tail, __ATOMIC_RELAXED);
+    for(;;) {
+        cell = &q_cells[pos & q_mask];
+        seq = __atomic_load_n(&cell->c.seq, __ATOMIC_ACQUIRE);
+        if((dif = (long)(seq - pos)) == 0) {
+            if(__atomic_compare_exchange_n(&q.tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if(dif < 0) {
+            logmsg(LOG_WARNING, "work queue full (%lu)", q_mask + 1);
+            return -1;
+        } else
+            pos = __atomic_load_n(&q.tail, __ATOMIC_RELAXED);
+    }
+    memcpy(&cell->c.arg, arg, sizeof(thr_arg));
+    cell->c.arg.t_queued = mono_ms();
+    __atomic_store_n(&cell->c.seq, pos + 1, __ATOMIC_RELEASE);
+    q_wake();
+    if(max_threads > min_threads && __atomic_load_n(&q.n_wait, __ATOMIC_SEQ_CST) <= 0
+    && get_thr_qlen() >= spawn_queue)
+        grow_pool("queue depth");
+    return 0;
+}
+
+/*
+ * get a request from the queue, waiting for one if necessary
+ * returns -1 if the calling worker should retire
+ */
+int
+get_thr_arg(thr_arg *arg)
+{
+    unsigned int    seq;
+    int             to, res;
+
+    for(;;) {
+        if(!q_pop(arg))
+            break;
+        /* announce we are going to sleep, then make sure nothing came in meanwhile */
+        __atomic_add_fetch(&q.n_wait, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        seq = __atomic_load_n(&q.ev_seq, __ATOMIC_SEQ_CST);
+        if(!q_pop(arg)) {
+            __atomic_sub_fetch(&q.n_wait, 1, __ATOMIC_SEQ_CST);
+            break;
+        }
+        if(!ev_lead()) {
+            /* no event threads: poll the parked connections while there is nothing else to do */
+            __atomic_sub_fetch(&q.n_wait, 1, __ATOMIC_SEQ_CST);
+            if(q_pop(arg))
+                res = ev_poll(arg);
+            else {
+                ev_unlead();
+                res = 0;
+            }
+            /* let another idle worker take over polling */
+            q_wake();
+            if(!res)
+                break;
+            continue;
+        }
+        to = __atomic_load_n(&pool.threads, __ATOMIC_SEQ_CST) > min_threads? thread_idle: 0;
+        if(q_wait(seq, to)) {
+            __atomic_sub_fetch(&q.n_wait, 1, __ATOMIC_SEQ_CST);
+            /* a put_thr_arg() may have woken us (or nobody) just as we timed out */
+            if(!q_pop(arg))
+                break;
+            if(retire_worker()) {
+                /* ... or since: pass its wake-up on to another idle worker */
+                if(get_thr_qlen() > 0)
+                    q_wake();
+                return -1;
+            }
+            continue;
+        }
+        __atomic_sub_fetch(&q.n_wait, 1, __ATOMIC_SEQ_CST);
+    }
+    if(max_threads > min_threads && spawn_wait > 0 && mono_ms() - arg->t_queued >= spawn_wait
+    && get_thr_qlen() > 0)
+        grow_pool("queue wait");
+    return 0;
 }
 
 /*
@@ -182,14 +456,173 @@ get_thr_arg(void)
 int
 get_thr_qlen(void)
 {
-    int     res;
-    thr_arg *tap;
+    long    res;
 
-    (void)pthread_mutex_lock(&arg_mut);
-    for(res = 0, tap = first; tap != NULL; tap = tap->next, res++)
-        ;
-    (void)pthread_mutex_unlock(&arg_mut);
-    return res;
+    res = (long)(__atomic_load_n(&q.tail, __ATOMIC_RELAXED) - __atomic_load_n(&q.head, __ATOMIC_RELAXED));
+    return res < 0? 0: (int)res;
+}
+
+/*
+ * get the worker pool state
+ */
+void
+get_pool_stat(POOL_STAT *res)
+{
+    memset(res, 0, sizeof(POOL_STAT));
+    res->threads = __atomic_load_n(&pool.threads, __ATOMIC_SEQ_CST);
+    res->idle = __atomic_load_n(&q.n_wait, __ATOMIC_SEQ_CST);
+    res->min_threads = min_threads;
+    res->max_threads = max_threads;
+    res->spawned = __atomic_load_n(&pool.spawned, __ATOMIC_RELAXED);
+    res->retired = __atomic_load_n(&pool.retired, __ATOMIC_RELAXED);
+    res->last_spawn = pool.last_spawn;
+    res->last_retire = pool.last_retire;
+    return;
+}
+
+/*
+ * listener sockets
+ */
+static int  n_listeners = 0;
+
+/*
+ * open a listening socket for a listener
+ */
+static int
+open_listener(LISTENER *lstn)
+{
+    int     sock, opt;
+    char    tmp[MAXBUF];
+
+    if((sock = socket(lstn->addr.ai_family == AF_INET? PF_INET: PF_INET6, SOCK_STREAM, 0)) < 0) {
+        addr2str(tmp, MAXBUF - 1, &lstn->addr, 0);
+        logmsg(LOG_ERR, "HTTP socket %s create: %s - aborted", tmp, strerror(errno));
+        exit(1);
+    }
+    opt = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (void *)&opt, sizeof(opt));
+#ifdef  SO_REUSEPORT
+    /* several sockets on the same address - the kernel spreads the connections between them */
+    if(acceptors > 1 && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (void *)&opt, sizeof(opt)) < 0) {
+        addr2str(tmp, MAXBUF - 1, &lstn->addr, 0);
+        logmsg(LOG_ERR, "HTTP socket %s SO_REUSEPORT: %s - aborted", tmp, strerror(errno));
+        exit(1);
+    }
+#endif
+    if(bind(sock, lstn->addr.ai_addr, (socklen_t)lstn->addr.ai_addrlen) < 0) {
+        addr2str(tmp, MAXBUF - 1, &lstn->addr, 0);
+        logmsg(LOG_ERR, "HTTP socket bind %s: %s - aborted", tmp, strerror(errno));
+        exit(1);
+    }
+    listen(sock, 512);
+    return sock;
+}
+
+/*
+ * close all the listening sockets (stop accepting new connections)
+ */
+static void
+close_listeners(void)
+{
+    LISTENER    *lstn;
+    int         i;
+
+    for(lstn = listeners; lstn; lstn = lstn->next) {
+        for(i = 1; i < acceptors; i++)
+            if(lstn->socks[i] != lstn->sock) {
+                /* shutdown() wakes up the acceptor thread polling the socket */
+                shutdown(lstn->socks[i], SHUT_RDWR);
+                close(lstn->socks[i]);
+            }
+        if(acceptors > 0)
+            shutdown(lstn->sock, SHUT_RDWR);
+        close(lstn->sock);
+    }
+    return;
+}
+
+/*
+ * accept a connection on a listening socket and hand it over for processing
+ */
+static void
+do_accept(LISTENER *lstn, const int sock)
+{
+    thr_arg arg;
+    int     clnt;
+
+    memset(&arg.from_addr, 0, sizeof(arg.from_addr));
+    arg.from_len = (socklen_t)sizeof(arg.from_addr);
+#if HAVE_ACCEPT4
+    if((clnt = accept4(sock, (struct sockaddr *)&arg.from_addr, &arg.from_len, SOCK_CLOEXEC)) < 0) {
+#else
+    if((clnt = accept(sock, (struct sockaddr *)&arg.from_addr, &arg.from_len)) < 0) {
+#endif
+        if(!shut_down)
+            logmsg(LOG_WARNING, "HTTP accept: %s", strerror(errno));
+        return;
+    }
+    if(arg.from_addr.ss_family != AF_INET && arg.from_addr.ss_family != AF_INET6) {
+        /* may happen on FreeBSD, I am told */
+        logmsg(LOG_WARNING, "HTTP connection prematurely closed by peer");
+        close(clnt);
+        return;
+    }
+    if(lstn->disabled) {
+        /*
+        addr2str(tmp, MAXBUF - 1, &clnt_addr, 1);
+        logmsg(LOG_WARNING, "HTTP disabled listener from %s", tmp);
+        */
+        close(clnt);
+        return;
+    }
+    arg.sock = clnt;
+    arg.lstn = lstn;
+    arg.conn = NULL;
+    arg.t_accept = mono_ms();
+    if(lstn->max_qdepth > 0 && get_thr_qlen() >= lstn->max_qdepth) {
+        /* overloaded - don't let the queue grow any further */
+        shed_conn(&arg);
+        return;
+    }
+    /* with the event engine the workers only see clients that sent something */
+    if(ev_park(&arg, lstn->to) && put_thr_arg(&arg))
+        shed_conn(&arg);
+    return;
+}
+
+/*
+ * Acceptor thread: accept on its own socket of every listener
+ */
+static void *
+thr_accept(void *arg)
+{
+    struct pollfd   *polls;
+    LISTENER        *lstn;
+    int             n, i;
+
+    n = (int)(long)arg;
+    if((polls = (struct pollfd *)calloc(n_listeners, sizeof(struct pollfd))) == NULL) {
+        logmsg(LOG_ERR, "Out of memory for acceptor poll - aborted");
+        exit(1);
+    }
+    for(lstn = listeners, i = 0; lstn; lstn = lstn->next, i++)
+        polls[i].fd = lstn->socks[n];
+    while(!shut_down) {
+        for(i = 0; i < n_listeners; i++) {
+            polls[i].events = POLLIN | POLLPRI;
+            polls[i].revents = 0;
+        }
+        if(poll(polls, n_listeners, -1) < 0) {
+            if(errno != EINTR)
+                logmsg(LOG_WARNING, "acceptor poll: %s", strerror(errno));
+            continue;
+        }
+        for(lstn = listeners, i = 0; lstn && !shut_down; lstn = lstn->next, i++)
+            if(polls[i].revents & (POLLIN | POLLPRI))
+                do_accept(lstn, polls[i].fd);
+    }
+    free(polls);
+    return NULL;
 }
 
 /*
@@ -213,12 +646,10 @@ static RETSIGTYPE
 h_shut(const int sig)
 {
     int         status;
-    LISTENER    *lstn;
 
     logmsg(LOG_NOTICE, "received signal %d - shutting down...", sig);
     if(son > 0) {
-        for(lstn = listeners; lstn; lstn = lstn->next)
-            close(lstn->sock);
+        close_listeners();
         kill(son, sig);
         (void)wait(&status);
         if(ctrl_name != NULL)
@@ -328,7 +759,7 @@ static void shutdown_plugins(void)
 int
 main(const int argc, char **argv)
 {
-    int                 n_listeners, i, clnt_length, clnt;
+    int                 i;
     struct pollfd       *polls;
     LISTENER            *lstn;
     pthread_t           thr;
@@ -336,8 +767,6 @@ main(const int argc, char **argv)
     uid_t               user_id;
     gid_t               group_id;
     FILE                *fpid;
-    struct sockaddr_storage clnt_addr;
-    char                tmp[MAXBUF];
 #ifndef SOL_TCP
     struct protoent     *pe;
 #endif
@@ -361,7 +790,6 @@ main(const int argc, char **argv)
     SSL_library_init();
     OpenSSL_add_all_algorithms();
     l_init();
-    init_thr_arg();
     CRYPTO_set_id_callback(l_id);
     CRYPTO_set_locking_callback(l_lock);
     init_timer();
@@ -384,13 +812,10 @@ main(const int argc, char **argv)
 #endif
 
     /* prepare regular expressions */
-    if(regcomp(&HEADER, "^([a-z0-9!#$%&'*+.^_`|~-]+):[ \t]*(.*)[ \t]*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
-    || regcomp(&CONN_UPGRD, "(^|[ \t,])upgrade([ \t,]|$)", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
-    || regcomp(&CHUNK_HEAD, "^([0-9a-f]+).*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
+    if(regcomp(&CONN_UPGRD, "(^|[ \t,])upgrade([ \t,]|$)", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
     || regcomp(&RESP_SKIP, "^HTTP/1.1 100.*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
     || regcomp(&RESP_IGN, "^HTTP/1.[01] (10[1-9]|1[1-9][0-9]|204|30[456]).*$", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
     || regcomp(&LOCATION, "(http|https)://([^/]+)(.*)", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
-    || regcomp(&AUTHORIZATION, "Authorization:[ \t]*Basic[ \t]*\"?([^ \t]*)\"?[ \t]*", REG_ICASE | REG_NEWLINE | REG_EXTENDED)
     ) {
         logmsg(LOG_ERR, "bad essential Regex - aborted");
         exit(1);
@@ -407,6 +832,8 @@ main(const int argc, char **argv)
 
     /* read config */
     config_parse(argc, argv);
+    init_thr_arg();
+    init_linebuf();
 
     
     if(log_facility != -1)
@@ -434,22 +861,22 @@ main(const int argc, char **argv)
 
     /* open listeners */
     for(lstn = listeners, n_listeners = 0; lstn; lstn = lstn->next, n_listeners++) {
-        int opt;
-
-        /* prepare the socket */
-        if((lstn->sock = socket(lstn->addr.ai_family == AF_INET? PF_INET: PF_INET6, SOCK_STREAM, 0)) < 0) {
-            addr2str(tmp, MAXBUF - 1, &lstn->addr, 0);
-            logmsg(LOG_ERR, "HTTP socket %s create: %s - aborted", tmp, strerror(errno));
-            exit(1);
-        }
-        opt = 1;
-        setsockopt(lstn->sock, SOL_SOCKET, SO_REUSEADDR, (void *)&opt, sizeof(opt));
-        if(bind(lstn->sock, lstn->addr.ai_addr, (socklen_t)lstn->addr.ai_addrlen) < 0) {
-            addr2str(tmp, MAXBUF - 1, &lstn->addr, 0);
-            logmsg(LOG_ERR, "HTTP socket bind %s: %s - aborted", tmp, strerror(errno));
-            exit(1);
+        lstn->sock = open_listener(lstn);
+        init_shed(lstn);
+        if(acceptors > 0) {
+            if((lstn->socks = (int *)calloc(acceptors, sizeof(int))) == NULL) {
+                logmsg(LOG_ERR, "Out of memory for listener sockets - aborted");
+                exit(1);
+            }
+            lstn->socks[0] = lstn->sock;
+            for(i = 1; i < acceptors; i++)
+#ifdef  SO_REUSEPORT
+                lstn->socks[i] = open_listener(lstn);
+#else
+                /* no SO_REUSEPORT - the acceptors share the one socket */
+                lstn->socks[i] = lstn->sock;
+#endif
         }
-        listen(lstn->sock, 512);
     }
 
     /* alloc the poll structures */
@@ -565,7 +992,13 @@ main(const int argc, char **argv)
 #endif
             /* start timer */
             if(pthread_create(&thr, &attr, thr_timer, NULL)) {
-                logmsg(LOG_ERR, "create thr_resurect: %s - aborted", strerror(errno));
+                logmsg(LOG_ERR, "create thr_timer: %s - aborted", strerror(errno));
+                exit(1);
+            }
+
+            /* start the health checks */
+            if(pthread_create(&thr, &attr, thr_health, NULL)) {
+                logmsg(LOG_ERR, "create thr_health: %s - aborted", strerror(errno));
                 exit(1);
             }
 
@@ -575,25 +1008,42 @@ main(const int argc, char **argv)
                 exit(1);
             }
 
+            /* start the event engine (if needed) */
+            if(init_event()) {
+                logmsg(LOG_ERR, "event engine init failed - aborted");
+                exit(1);
+            }
+            for(i = 0; i < ev_threads; i++)
+                if(pthread_create(&thr, &attr, thr_event, (void *)(long)i)) {
+                    logmsg(LOG_ERR, "create thr_event: %s - aborted", strerror(errno));
+                    exit(1);
+                }
+
             /* pause to make sure the service threads were started */
             sleep(1);
 
             /* create the worker threads */
-            for(i = 0; i < numthreads; i++)
-                if(pthread_create(&thr, &attr, thr_http, NULL)) {
-                    logmsg(LOG_ERR, "create thr_http: %s - aborted", strerror(errno));
+            for(i = 0; i < min_threads; i++)
+                if(start_worker()) {
+                    logmsg(LOG_ERR, "can't start the worker threads - aborted");
                     exit(1);
                 }
 
             /* pause to make sure at least some of the worker threads were started */
             sleep(1);
 
+            /* start the acceptor threads (if needed) */
+            for(i = 0; i < acceptors; i++)
+                if(pthread_create(&thr, &attr, thr_accept, (void *)(long)i)) {
+                    logmsg(LOG_ERR, "create thr_accept: %s - aborted", strerror(errno));
+                    exit(1);
+                }
+
             /* and start working */
             for(;;) {
                 if(shut_down) {
                     logmsg(LOG_NOTICE, "shutting down...");
-                    for(lstn = listeners; lstn; lstn = lstn->next)
-                        close(lstn->sock);
+                    close_listeners();
                     if(grace > 0) {
                         sleep(grace);
                         logmsg(LOG_NOTICE, "grace period expired - exiting...");
@@ -603,6 +1053,11 @@ main(const int argc, char **argv)
 		    shutdown_plugins();
                     exit(0);
                 }
+                if(acceptors > 0) {
+                    /* the acceptor threads do the work */
+                    sleep(1);
+                    continue;
+                }
                 for(lstn = listeners, i = 0; i < n_listeners; lstn = lstn->next, i++) {
                     polls[i].events = POLLIN | POLLPRI;
                     polls[i].revents = 0;
@@ -610,46 +1065,9 @@ main(const int argc, char **argv)
                 if(poll(polls, n_listeners, -1) < 0) {
                     logmsg(LOG_WARNING, "poll: %s", strerror(errno));
                 } else {
-                    for(lstn = listeners, i = 0; lstn; lstn = lstn->next, i++) {
-                        if(polls[i].revents & (POLLIN | POLLPRI)) {
-                            memset(&clnt_addr, 0, sizeof(clnt_addr));
-                            clnt_length = sizeof(clnt_addr);
-                            if((clnt = accept(lstn->sock, (struct sockaddr *)&clnt_addr,
-                                (socklen_t *)&clnt_length)) < 0) {
-                                logmsg(LOG_WARNING, "HTTP accept: %s", strerror(errno));
-                            } else if(((struct sockaddr_in *)&clnt_addr)->sin_family == AF_INET
-                                   || ((struct sockaddr_in *)&clnt_addr)->sin_family == AF_INET6) {
-                                thr_arg arg;
-
-                                if(lstn->disabled) {
-                                    /*
-                                    addr2str(tmp, MAXBUF - 1, &clnt_addr, 1);
-                                    logmsg(LOG_WARNING, "HTTP disabled listener from %s", tmp);
-                                    */
-                                    close(clnt);
-                                }
-                                arg.sock = clnt;
-                                arg.lstn = lstn;
-                                if((arg.from_host.ai_addr = (struct sockaddr *)malloc(clnt_length)) == NULL) {
-                                    logmsg(LOG_WARNING, "HTTP arg address: malloc");
-                                    close(clnt);
-                                    continue;
-                                }
-                                memcpy(arg.from_host.ai_addr, &clnt_addr, clnt_length);
-                                arg.from_host.ai_addrlen = clnt_length;
-                                if(((struct sockaddr_in *)&clnt_addr)->sin_family == AF_INET)
-                                    arg.from_host.ai_family = AF_INET;
-                                else
-                                    arg.from_host.ai_family = AF_INET6;
-                                if(put_thr_arg(&arg))
-                                    close(clnt);
-                            } else {
-                                /* may happen on FreeBSD, I am told */
-                                logmsg(LOG_WARNING, "HTTP connection prematurely closed by peer");
-                                close(clnt);
-                            }
-                        }
-                    }
+                    for(lstn = listeners, i = 0; lstn; lstn = lstn->next, i++)
+                        if(polls[i].revents & (POLLIN | POLLPRI))
+                            do_accept(lstn, lstn->sock);
                 }
             }
 #if SUPERVISOR
@@ -131,6 +131,21 @@
 #error "Pound needs sys/poll.h"
 #endif
 
+#if HAVE_SYS_UIO_H
+#include    <sys/uio.h>
+#endif
+
+#if HAVE_SYS_EPOLL_H
+#include    <sys/epoll.h>
+#endif
+
+#if HAVE_LINUX_FUTEX_H && HAVE_SYS_SYSCALL_H
+#include    <linux/futex.h>
+#include    <sys/syscall.h>
+#else
+#undef  HAVE_LINUX_FUTEX_H
+#endif
+
 #if HAVE_OPENSSL_SSL_H
 #define OPENSSL_THREAD_DEFINES
 #include    <openssl/ssl.h>
@@ -271,21 +286,28 @@ extern char *user,              /* user to run as */
             *ctrl_name;         /* control socket name */
 
 extern int  numthreads,         /* number of worker threads */
+            queue_size,         /* size of the work queue */
+            min_threads,        /* worker pool: min. number of threads */
+            max_threads,        /* worker pool: max. number of threads */
+            thread_idle,        /* worker pool: retire threads idle for so many seconds */
+            spawn_queue,        /* worker pool: grow when so many requests are queued */
+            spawn_wait,         /* worker pool: grow when requests wait so many msec */
             anonymise,          /* anonymise client address */
             alive_to,           /* check interval for resurrection */
             daemonize,          /* run as daemon */
             log_facility,       /* log facility to use */
             print_log,          /* print log messages to stdout/stderr */
             grace,              /* grace period before shutdown */
-            control_sock;       /* control socket */
+            control_sock,       /* control socket */
+            ev_threads,         /* number of event threads (0: no event engine) */
+            park_idle,          /* no event threads: idle workers poll the parked connections */
+            acceptors,          /* number of acceptor threads (0: accept in the main thread) */
+            relay_flush;        /* relays (RPC, WebSocket, content until EOF) flush after every read */
 
-extern regex_t  HEADER,     /* Allowed header */
-                CONN_UPGRD, /* upgrade in connection header */
-                CHUNK_HEAD, /* chunk header line */
+extern regex_t  CONN_UPGRD, /* upgrade in connection header */
                 RESP_SKIP,  /* responses for which we skip response */
                 RESP_IGN,   /* responses for which we ignore content */
-                LOCATION,   /* the host we are redirected to */
-                AUTHORIZATION;  /* the Authorisation header */
+                LOCATION;   /* the host we are redirected to */
 
 #ifndef  SOL_TCP
 /* for systems without the definition */
@@ -300,6 +322,22 @@ extern int  SOL_TCP;
 
 #define MAXHEADERS  128
 
+#ifndef HDR_ARENA
+#define HDR_ARENA   (4 * MAXBUF)    /* initial size of the header arena */
+#endif
+
+/* request/response headers: NUL-terminated lines kept one after the other in a single arena */
+typedef struct {
+    char    *arena;
+    int     size;                   /* arena size */
+    int     used;                   /* bytes in use */
+    int     n;                      /* number of lines, the request/status line included */
+    int     off[MAXHEADERS];        /* where each line starts in the arena */
+    int     len[MAXHEADERS];        /* and its length */
+}   HEADERS;
+
+#define HDR(h, i)   ((h)->arena + (h)->off[i])
+
 #ifndef F_CONF
 #define F_CONF  "/usr/local/etc/pound.cfg"
 #endif
@@ -314,10 +352,59 @@ typedef struct _matcher {
     struct _matcher     *next;
 }   MATCHER;
 
+/* request methods, in xHTTP order: each level allows a prefix of the list */
+typedef enum    {
+    METH_GET, METH_POST, METH_HEAD,
+    METH_PUT, METH_PATCH, METH_DELETE,
+    METH_LOCK, METH_UNLOCK, METH_PROPFIND, METH_PROPPATCH, METH_SEARCH, METH_MKCOL, METH_MOVE, METH_COPY,
+    METH_OPTIONS, METH_TRACE, METH_MKACTIVITY, METH_CHECKOUT, METH_MERGE, METH_REPORT,
+    METH_SUBSCRIBE, METH_UNSUBSCRIBE, METH_BPROPPATCH, METH_POLL, METH_BMOVE, METH_BCOPY, METH_BDELETE,
+    METH_BPROPFIND, METH_NOTIFY, METH_CONNECT,
+    METH_RPC_IN_DATA, METH_RPC_OUT_DATA
+}   METHOD;
+
 /* back-end types */
 typedef enum    { SESS_NONE, SESS_IP, SESS_COOKIE, SESS_URL, SESS_PARM, SESS_HEADER, SESS_BASIC }   SESS_TYPE;
 
+/* how to choose a back-end for a new request */
+typedef enum    { BAL_RANDOM, BAL_LEASTTIME, BAL_LEASTCONN, BAL_ROUNDROBIN }   BAL_TYPE;
+
 /* back-end definition */
+/* a back-end connection (opaque outside http.c) */
+typedef struct _be_conn     BE_CONN;
+
+/* active HTTP health check */
+typedef struct {
+    char                *req;       /* request line and extra headers, each CRLF-terminated */
+    int                 has_host;   /* a Host header is among them */
+    int                 status;     /* expected status (0: any 2xx/3xx) */
+    int                 has_body;
+    regex_t             body;       /* pattern the response body must match */
+    int                 max_lat;    /* max. response time (msec, 0: none) */
+    int                 rise;       /* successes in a row to resurrect a dead back-end */
+    int                 fall;       /* failures in a row to kill an alive one */
+}   HEALTH;
+
+/* outlier detection looks at the responses of the last OD_WINDOW seconds */
+#define OD_WINDOW   10
+
+typedef struct {
+    time_t              sec;        /* the second counted here */
+    int                 n_req;      /* responses */
+    int                 n_err;      /* 5xx responses and failed reads */
+    int                 n_slow;     /* responses slower than OUTLIER.slow_ms */
+}   OD_SLOT;
+
+typedef struct {
+    int                 errors;     /* errors in a row that eject a back-end (0: no limit) */
+    int                 err_rate;   /* % of errors in the window that eject it (0: no limit) */
+    int                 slow_ms;    /* responses slower than this (msec)... */
+    int                 slow_rate;  /* ... eject it if they are this % of the window (0: no limit) */
+    int                 min_req;    /* responses in the window needed to judge the rates */
+    int                 eject;      /* ejection time (seconds), doubled for each ejection in a row */
+    int                 max_eject;  /* max. % of the back-ends ejected at a time */
+}   OUTLIER;
+
 typedef struct _backend {
     char 	        *name;	    /* name from config file */
     int                 be_type;    /* 0 if real back-end, otherwise code (301, 302/default, 307) */
@@ -333,10 +420,27 @@ typedef struct _backend {
     pthread_mutex_t     mut;        /* mutex for this back-end */
     int                 n_requests; /* number of requests seen */
     double              t_requests; /* time to answer these requests */
-    double              t_average;  /* average time to answer requests */
+    double              t_average;  /* average time to answer requests (usec, moving average) */
+    unsigned long       t_stamp;    /* when t_average was last updated (msec, monotonic) */
+    int                 n_active;   /* requests in progress */
     int                 alive;      /* false if the back-end is dead */
-    int                 resurrect;  /* this back-end is to be resurrected */
+    int                 alive_to;   /* health check interval */
     int                 disabled;   /* true if the back-end is disabled */
+    int                 pool_max;   /* max. idle keep-alive connections kept (0: no pool) */
+    int                 pool_to;    /* ... for how long (seconds) */
+    int                 pool_reqs;  /* max. requests per connection (0: no limit) */
+    BE_CONN             *pool;      /* the idle connections, most recently used first */
+    int                 n_pool;
+    SSL_SESSION         *sess;      /* last TLS session, offered for resumption */
+    unsigned long       sess_hits;  /* TLS handshakes that resumed it */
+    unsigned long       sess_misses;/* ... that did not */
+    HEALTH              *health;    /* active HTTP check (NULL: connect only) */
+    OD_SLOT             od[OD_WINDOW]; /* responses per second, for outlier detection */
+    int                 od_fails;   /* errors in a row */
+    time_t              od_checked; /* when the rates were last checked */
+    int                 n_eject;    /* ejections in a row */
+    time_t              eject_until;/* ejected as an outlier until then */
+    int                 ejected;    /* out as an outlier, until resurrected */
     struct _backend     *next;
 }   BACKEND;
 
@@ -371,6 +475,20 @@ DECLARE_LHASH_OF(TABNODE);
 
 	
 /* service definition */
+/* a snapshot of the back-ends a service may use */
+typedef struct _be_set {
+    int                 n;          /* alive and enabled back-ends */
+    BACKEND             **be;
+    int                 *prob;      /* alias table for random picks: be[i] with probability prob[i] / tot_pri, */
+    int                 *alias;     /* ... otherwise be[alias[i]] */
+    int                 tot_pri;
+    BACKEND             **hash_tab; /* consistent-hash table (sess_ttl < 0) */
+    int                 hash_size;  /* ... its slots (prime) */
+    int                 *rr;        /* round-robin order, tot_pri picks (Balance RoundRobin) */
+    unsigned long       epoch;      /* when it was replaced */
+    struct _be_set      *next;      /* replaced sets waiting to be freed */
+}   BE_SET;
+
 typedef struct _service {
     char                name[KEY_SIZE + 1]; /* symbolic name */
     MATCHER             *url,       /* request matcher */
@@ -382,7 +500,12 @@ typedef struct _service {
     int                 tot_pri;    /* total priority for current back-ends */
     pthread_mutex_t     mut;        /* mutex for this service */
     SESS_TYPE           sess_type;
+    BAL_TYPE            balance;    /* how to choose a back-end */
+    unsigned int        rr_next;    /* round-robin picks so far */
     int                 sess_ttl;   /* session time-to-live */
+    BE_SET              *live;      /* the back-ends in use now (replaced, never modified) */
+    int                 hash_load;  /* max. load of a back-end, % of its share (0: no limit) */
+    OUTLIER             *outlier;   /* outlier detection (NULL: none) */
     regex_t             sess_start; /* pattern to identify the session data */
     regex_t             sess_pat;   /* pattern to match the session data */
 #if OPENSSL_VERSION_NUMBER >= 0x10000000L
@@ -413,11 +536,12 @@ typedef struct _pound_ctx {
 typedef struct _listener {
     struct addrinfo     addr;               /* IPv4/6 address */
     int                 sock;               /* listening socket */
+    int                 *socks;             /* one socket per acceptor thread (Acceptors) */
     POUND_CTX           *ctx;               /* CTX for SSL connections */
     int                 clnt_check;         /* client verification mode */
     int                 noHTTPS11;          /* HTTP 1.1 mode for SSL */
     char                *add_head;          /* extra SSL header */
-    regex_t             verb;               /* pattern to match the request verb against */
+    unsigned int        verb;               /* allowed request methods (bit per METHOD) */
     int                 to;                 /* client time-out */
     int                 has_pat;            /* was a URL pattern defined? */
     regex_t             url_pat;            /* pattern to match the request URL against */
@@ -433,6 +557,10 @@ typedef struct _listener {
     int                 log_level;          /* log level for this listener */
     int                 allow_client_reneg; /* Allow Client SSL Renegotiation */
     int                 disable_ssl_v2;     /* Disable SSL version 2 */
+    int                 max_qwait;          /* shed clients waiting longer (msec, 0: no limit) */
+    int                 max_qdepth;         /* shed clients when the queue is this long (0: no limit) */
+    char                *shed503;           /* precomputed 503 reply for shed clients */
+    int                 shed503_len;
     SERVICE             *services;
     struct _listener    *next;
 }   LISTENER;
@@ -441,11 +569,17 @@ typedef struct _listener {
 extern LISTENER         *listeners; /* all available listeners */
 #endif /* NO_EXTERNALS */
 
+/* client connection state (opaque outside http.c) */
+typedef struct _http_conn   HTTP_CONN;
+
 typedef struct _thr_arg {
     int             sock;
     LISTENER        *lstn;
-    struct addrinfo from_host;
-    struct _thr_arg *next;
+    struct sockaddr_storage from_addr;  /* client address */
+    socklen_t       from_len;
+    HTTP_CONN       *conn;          /* parked connection to resume, NULL for a new one */
+    unsigned long   t_accept;       /* when it was accepted or, if parked, became readable (msec, monotonic) */
+    unsigned long   t_queued;       /* when it was put on the work queue (msec, monotonic) */
 }   thr_arg;                        /* argument to processing threads: socket, origin */
 
 /* Track SSL handshare/renegotiation so we can reject client-renegotiations. */
@@ -466,6 +600,19 @@ typedef enum { RENEG_INIT=0, RENEG_REJECT, RENEG_ALLOW, RENEG_ABORT } RENEG_STAT
 #define HEADER_DESTINATION          10
 #define HEADER_EXPECT               11
 #define HEADER_UPGRADE              13
+#define HEADER_AUTHORIZATION        14
+
+/* worker pool state, as reported on the control socket */
+typedef struct {
+    int             threads;        /* running worker threads */
+    int             idle;           /* ... of which waiting for work */
+    int             min_threads;
+    int             max_threads;
+    unsigned long   spawned;        /* threads started because of queue pressure */
+    unsigned long   retired;        /* idle threads retired */
+    time_t          last_spawn;     /* when that happened last (0: never) */
+    time_t          last_retire;
+}   POOL_STAT;
 
 /* control request stuff */
 typedef enum    {
@@ -507,18 +654,97 @@ extern int  put_thr_arg(thr_arg *);
 /*
  * get a request from the queue
  */
-extern thr_arg  *get_thr_arg(void);
+extern int  get_thr_arg(thr_arg *);
 
 /*
  * get the current queue length
  */
 extern int get_thr_qlen(void);
 
+/*
+ * get the worker pool state
+ */
+extern void get_pool_stat(POOL_STAT *);
+
+/*
+ * monotonic time in milliseconds
+ */
+extern unsigned long mono_ms(void);
+
 /*
  * handle an HTTP request
  */
 extern void *thr_http(void *);
 
+/*
+ * close the pooled back-end connections that were idle too long
+ */
+extern void be_pool_expire(void);
+
+/*
+ * the shortest idle time-out of the pooled back-end connections (0 if no pooling)
+ */
+extern int  be_pool_tick(void);
+
+/*
+ * close a connection nobody is going to process
+ */
+extern void drop_conn(thr_arg *, const int);
+
+/*
+ * prepare the 503 reply for shed clients
+ */
+extern void init_shed(LISTENER *);
+
+/*
+ * turn a client away with a 503 without processing the request
+ */
+extern void shed_conn(thr_arg *);
+
+/*
+ * prepare the event engine
+ */
+extern int  init_event(void);
+
+/*
+ * park a connection in the event engine until the client sends something
+ */
+extern int  ev_park(thr_arg *, const int);
+
+/*
+ * event engine thread
+ */
+extern void *thr_event(void *);
+
+/*
+ * shared event engine (no event threads): idle workers take turns polling
+ */
+extern int  ev_lead(void);
+extern void ev_unlead(void);
+extern int  ev_poll(thr_arg *);
+extern void ev_wake(void);
+
+/*
+ * set up the line buffer BIO type
+ */
+extern void init_linebuf(void);
+
+/*
+ * a new line buffer BIO (replaces BIO_f_buffer on client and back-end connections)
+ */
+extern BIO  *BIO_new_linebuf(void);
+
+/*
+ * get a line from a line buffer BIO - returns -1 if the BIO is not one
+ */
+extern int  lb_get_line(BIO *const, char *const, const int);
+
+/*
+ * look at/take out the buffered input of a line buffer BIO - lb_peek returns -2 if the BIO is not one
+ */
+extern int  lb_peek(BIO *const, const char **);
+extern void lb_consume(BIO *const, const int);
+
 /*
  * Log an error to the syslog or to stderr
  */
@@ -542,12 +768,12 @@ extern void addr2str(char *, const int, const struct addrinfo *, const int);
 /*
  * Find the right service for a request
  */
-extern SERVICE  *get_service(const LISTENER *, const char *, char **const);
+extern SERVICE  *get_service(const LISTENER *, const char *, const HEADERS *);
 
 /*
  * Find the right back-end for a request
  */
-extern BACKEND  *get_backend(SERVICE *const, const struct addrinfo *, const char *, char **const);
+extern BACKEND  *get_backend(SERVICE *const, const struct addrinfo *, const char *, const HEADERS *);
 
 /*
  * Search for a host name, return the addrinfo for it
@@ -564,26 +790,60 @@ extern int  need_rewrite(const int, char *const, char *const, const char *, cons
 /*
  * (for cookies only) possibly create session based on response headers
  */
-extern void upd_session(SERVICE *const, char **const, BACKEND *const);
+extern void upd_session(SERVICE *const, const HEADERS *, BACKEND *const);
 
 /*
  * Parse a header
  */
 extern int  check_header(const char *, char *);
 
+/*
+ * Parse the request line
+ */
+extern int  check_request(const char *, int *, int *);
+
 #define BE_DISABLE  -1
 #define BE_KILL     1
 #define BE_ENABLE   0
+#define BE_RESURRECT    2
+#define BE_EJECT    3
 /*
- * mark a backend host as dead;
+ * mark a backend host as dead (or alive again: BE_RESURRECT, or dead for a while: BE_EJECT);
  * do nothing if no resurection code is active
  */
 extern void kill_be(SERVICE *const, const BACKEND *, const int);
 
+/*
+ * publish the current back-ends of a service for get_backend()
+ * (-1 if out of memory)
+ */
+extern int  be_publish(SERVICE *const);
+
+/*
+ * free the replaced back-end sets no thread can still be using
+ */
+extern void be_reclaim(void);
+
+/*
+ * per-thread pseudo-random numbers for the back-end picks
+ */
+extern unsigned int be_rand(void);
+
+/*
+ * build the alias table of a back-end set (non-zero if out of memory)
+ */
+extern int  alias_build(BE_SET *);
+
+/*
+ * a random back-end of a set, in proportion to the priorities
+ */
+extern BACKEND *rand_backend(const BE_SET *);
+
 /*
  * Update the number of requests and time to answer for a given back-end
+ * (and its outlier statistics: code is the response status, 0 if none came)
  */
-extern void upd_be(SERVICE *const svc, BACKEND *const be, const double);
+extern void upd_be(SERVICE *const svc, BACKEND *const be, const double, const int);
 
 /*
  * Non-blocking version of connect(2). Does the same as connect(2) but
@@ -619,6 +879,12 @@ extern DH   *DH_tmp_callback(SSL *, int, int);
  */
 extern void SSLINFO_callback(const SSL *s, int where, int rc);
 
+/*
+ * TLS session resumption for back-ends: keep the new session, offer it on the next connection
+ */
+extern int  be_new_session(SSL *, SSL_SESSION *);
+extern void be_resume(BACKEND *const, SSL *const);
+
 /*
  * expiration stuff
  */
@@ -640,11 +906,16 @@ extern void init_timer(void);
 /*
  * run timed functions:
  *  - RSAgen every T_RSA_KEYS seconds
- *  - resurrect every alive_to seconds
  *  - expire every EXPIRE_TO seconds
+ *  - expire idle pooled back-end connections every round
  */
 extern void *thr_timer(void *);
 
+/*
+ * health checks: probe all the back-ends in parallel, kill/resurrect them
+ */
+extern void *thr_health(void *);
+
 /*
  * The controlling thread
  * listens to client requests and calls the appropriate functions
@@ -114,13 +114,25 @@ be_prt(const int sock)
             be.ha_addr.ai_addr = (struct sockaddr *)&h;
         }
         if(xml_out)
-            printf("<backend index=\"%d\" address=\"%s\" avg=\"%.3f\" priority=\"%d\" alive=\"%s\" status=\"%s\" />\n",
+            printf("<backend index=\"%d\" address=\"%s\" avg=\"%.3f\" priority=\"%d\" alive=\"%s\" status=\"%s\" pool=\"%d\" tls_resumed=\"%lu\" tls_full=\"%lu\" active=\"%d\" />\n",
                 n_be++,
                 prt_addr(&be.addr), be.t_average / 1000000, be.priority, be.alive? "yes": "DEAD",
-                be.disabled? "DISABLED": "active");
-        else
-            printf("    %3d. Backend %s %s (%d %.3f sec) %s\n", n_be++, prt_addr(&be.addr),
+                be.disabled? "DISABLED": "active", be.n_pool, be.sess_hits, be.sess_misses, be.n_active);
+        else {
+            printf("    %3d. Backend %s %s (%d %.3f sec) %s", n_be++, prt_addr(&be.addr),
                 be.disabled? "DISABLED": "active", be.priority, be.t_average / 1000000, be.alive? "alive": "DEAD");
+            if(be.n_active > 0)
+                printf(", %d in progress", be.n_active);
+            if(be.eject_until > time(NULL))
+                printf(", ejected for %ld sec", (long)(be.eject_until - time(NULL)));
+            else if(be.ejected && !be.alive)
+                printf(", ejected");
+            if(be.pool_max > 0)
+                printf(", %d/%d idle", be.n_pool, be.pool_max);
+            if(be.ctx != NULL)
+                printf(", TLS %lu resumed/%lu full", be.sess_hits, be.sess_misses);
+            printf("\n");
+        }
     }
     return;
 }
@@ -218,6 +230,7 @@ main(const int argc, char **argv)
     char        *arg0, *sock_name;
     int         c_opt, en_lst, de_lst, en_svc, de_svc, en_be, de_be, a_sess, d_sess, is_set;
     LISTENER    lstn;
+    POOL_STAT   pool;
     struct  sockaddr_storage    a;
 
     arg0 = *argv;
@@ -349,6 +362,13 @@ main(const int argc, char **argv)
                 printf("<queue size=\"%d\"/>\n", n);
             else
                 printf("Requests in queue: %d\n", n);
+        if(read(sock, &pool, sizeof(pool)) == sizeof(pool))
+            if(xml_out)
+                printf("<threads running=\"%d\" idle=\"%d\" min=\"%d\" max=\"%d\" spawned=\"%lu\" retired=\"%lu\"/>\n",
+                    pool.threads, pool.idle, pool.min_threads, pool.max_threads, pool.spawned, pool.retired);
+            else
+                printf("Worker threads: %d (%d idle, min %d, max %d), %lu started, %lu retired\n",
+                    pool.threads, pool.idle, pool.min_threads, pool.max_threads, pool.spawned, pool.retired);
         while(read(sock, (void *)&lstn, sizeof(LISTENER)) == sizeof(LISTENER)) {
             if(lstn.disabled < 0)
                 break;
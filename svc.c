@@ -395,50 +395,123 @@ cpURL(char *res, char *src, int len)
     return res - kp_res;
 }
 
+/* HTTP token characters (RFC 7230), one bit per byte value */
+static const unsigned int tchar[8] = {
+    0x00000000, 0x03ff6cfa, 0xc7fffffe, 0x57ffffff, 0x00000000, 0x00000000, 0x00000000, 0x00000000
+};
+#define IS_TCHAR(c) (tchar[(unsigned char)(c) >> 5] & (1U << ((unsigned char)(c) & 31)))
+
+/*
+ * the known headers, placed by HD_HASH: (length + 4 * last char) mod 16 is collision-free for this set
+ * (generated once, gperf-style - re-check if a name is added)
+ */
+#define HD_HASH(h, len) (((len) + (((h)[(len) - 1] | 0x20) << 2)) & 15)
+
+static const struct {
+    char    header[20];
+    int     len;
+    int     val;
+} hd_types[16] = {
+    { "Location",           8,  HEADER_LOCATION },
+    { "",                   0,  HEADER_OTHER },
+    { "Connection",         10, HEADER_CONNECTION },
+    { "Destination",        11, HEADER_DESTINATION },
+    { "Host",               4,  HEADER_HOST },
+    { "Authorization",      13, HEADER_AUTHORIZATION },
+    { "Expect",             6,  HEADER_EXPECT },
+    { "",                   0,  HEADER_OTHER },
+    { "Content-location",   16, HEADER_CONTLOCATION },
+    { "",                   0,  HEADER_OTHER },
+    { "User-agent",         10, HEADER_USER_AGENT },
+    { "Upgrade",            7,  HEADER_UPGRADE },
+    { "",                   0,  HEADER_OTHER },
+    { "Transfer-encoding",  17, HEADER_TRANSFER_ENCODING },
+    { "Content-length",     14, HEADER_CONTENT_LENGTH },
+    { "Referer",            7,  HEADER_REFERER },
+};
+
 /*
  * Parse a header
  * return a code and possibly content in the arg
+ * the name must be a token followed by ':' - the value is everything after the leading blanks
  */
 int
 check_header(const char *header, char *const content)
 {
-    regmatch_t  matches[4];
-    static struct {
-        char    header[32];
-        int     len;
-        int     val;
-    } hd_types[] = {
-        { "Transfer-encoding",  17, HEADER_TRANSFER_ENCODING },
-        { "Content-length",     14, HEADER_CONTENT_LENGTH },
-        { "Connection",         10, HEADER_CONNECTION },
-        { "Location",           8,  HEADER_LOCATION },
-        { "Content-location",   16, HEADER_CONTLOCATION },
-        { "Host",               4,  HEADER_HOST },
-        { "Referer",            7,  HEADER_REFERER },
-        { "User-agent",         10, HEADER_USER_AGENT },
-        { "Destination",        11, HEADER_DESTINATION },
-        { "Expect",             6,  HEADER_EXPECT },
-        { "Upgrade",            7,  HEADER_UPGRADE },
-        { "",                   0,  HEADER_OTHER },
-    };
-    int i;
+    const char  *val;
+    int         len, i;
 
-    if(!regexec(&HEADER, header, 4, matches, 0)) {
-        for(i = 0; hd_types[i].len > 0; i++)
-            if((matches[1].rm_eo - matches[1].rm_so) == hd_types[i].len
-            && strncasecmp(header + matches[1].rm_so, hd_types[i].header, hd_types[i].len) == 0) {
-                /* we know that the original header was read into a buffer of size MAXBUF, so no overflow */
-                strncpy(content, header + matches[2].rm_so, matches[2].rm_eo - matches[2].rm_so);
-                content[matches[2].rm_eo - matches[2].rm_so] = '\0';
-                return hd_types[i].val;
-            }
-        return HEADER_OTHER;
-    } else
+    for(len = 0; IS_TCHAR(header[len]); len++)
+        ;
+    if(len == 0 || header[len] != ':')
         return HEADER_ILLEGAL;
+    i = HD_HASH(header, len);
+    if(hd_types[i].len != len || strncasecmp(header, hd_types[i].header, len))
+        return HEADER_OTHER;
+    for(val = header + len + 1; *val == ' ' || *val == '\t'; val++)
+        ;
+    /* we know that the original header was read into a buffer of size MAXBUF, so no overflow */
+    strcpy(content, val);
+    return hd_types[i].val;
+}
+
+/* method names, in METHOD order */
+static const struct {
+    char    name[16];
+    int     len;
+} methods[] = {
+    { "GET", 3 }, { "POST", 4 }, { "HEAD", 4 },
+    { "PUT", 3 }, { "PATCH", 5 }, { "DELETE", 6 },
+    { "LOCK", 4 }, { "UNLOCK", 6 }, { "PROPFIND", 8 }, { "PROPPATCH", 9 }, { "SEARCH", 6 }, { "MKCOL", 5 },
+    { "MOVE", 4 }, { "COPY", 4 }, { "OPTIONS", 7 }, { "TRACE", 5 }, { "MKACTIVITY", 10 }, { "CHECKOUT", 8 },
+    { "MERGE", 5 }, { "REPORT", 6 },
+    { "SUBSCRIBE", 9 }, { "UNSUBSCRIBE", 11 }, { "BPROPPATCH", 10 }, { "POLL", 4 }, { "BMOVE", 5 },
+    { "BCOPY", 5 }, { "BDELETE", 7 }, { "BPROPFIND", 9 }, { "NOTIFY", 6 }, { "CONNECT", 7 },
+    { "RPC_IN_DATA", 11 }, { "RPC_OUT_DATA", 12 },
+};
+
+/*
+ * METHOD by MT_HASH: (length + 8 * first char + 3 * last char) mod 64 is collision-free for the names above
+ * (generated once - re-check if a method is added)
+ */
+#define MT_HASH(m, len) (((len) + (((m)[0] | 0x20) << 3) + 3 * ((m)[(len) - 1] | 0x20)) & 63)
+
+static const signed char mt_hash[64] = {
+    25,  9, -1, -1, 24, 27, 26, 13, 23, -1, -1, -1, -1, -1, -1, -1,
+    20, -1, 22, -1, 15,  5, 10,  0, 14, -1, -1, 12, 18, 16, -1,  3,
+     1, 28, 21, -1, -1,  6, -1, -1, -1, -1, -1, -1, -1, -1, -1,  7,
+     2, 11, 19, -1,  8, -1, -1, -1, -1, -1, -1, 29, 17,  4, 30, 31,
+};
+
+/*
+ * Parse the request line "METHOD URL HTTP/1.x" in one scan
+ * return the METHOD (-1 if the line is malformed or the method unknown) and the URL offset/length in the args
+ * accepts exactly what "^(...) ([^ ]+) HTTP/1.[01]$" (case-insensitive) used to accept
+ */
+int
+check_request(const char *request, int *const url, int *const url_len)
+{
+    const char  *p;
+    int         len, m;
+
+    /* the longest method is RPC_OUT_DATA */
+    for(len = 0; len <= 12 && request[len] && request[len] != ' '; len++)
+        ;
+    if(len == 0 || request[len] != ' ')
+        return -1;
+    if((m = mt_hash[MT_HASH(request, len)]) < 0 || methods[m].len != len || strncasecmp(request, methods[m].name, len))
+        return -1;
+    for(p = request + len + 1; *p && *p != ' ' && *p != '\n'; p++)
+        ;
+    if(p == request + len + 1 || strncasecmp(p, " HTTP/1", 7) || !p[7] || p[7] == '\n' || (p[8] != '0' && p[8] != '1') || p[9])
+        return -1;
+    *url = len + 1;
+    *url_len = p - request - len - 1;
+    return m;
 }
 
 static int
-match_service(const SERVICE *svc, const char *request, char **const headers)
+match_service(const SERVICE *svc, const char *request, const HEADERS *headers)
 {
     MATCHER *m;
     int     i, found;
@@ -450,8 +523,8 @@ match_service(const SERVICE *svc, const char *request, char **const headers)
 
     /* check for required headers */
     for(m = svc->req_head; m; m = m->next) {
-        for(found = i = 0; i < (MAXHEADERS - 1) && !found; i++)
-            if(headers[i] && !regexec(&m->pat, headers[i], 0, NULL, 0))
+        for(found = 0, i = 1; i < headers->n && !found; i++)
+            if(!regexec(&m->pat, HDR(headers, i), 0, NULL, 0))
                 found = 1;
         if(!found)
             return 0;
@@ -459,8 +532,8 @@ match_service(const SERVICE *svc, const char *request, char **const headers)
 
     /* check for forbidden headers */
     for(m = svc->deny_head; m; m = m->next) {
-        for(found = i = 0; i < (MAXHEADERS - 1) && !found; i++)
-            if(headers[i] && !regexec(&m->pat, headers[i], 0, NULL, 0))
+        for(found = 0, i = 1; i < headers->n && !found; i++)
+            if(!regexec(&m->pat, HDR(headers, i), 0, NULL, 0))
                 found = 1;
         if(found)
             return 0;
@@ -473,7 +546,7 @@ match_service(const SERVICE *svc, const char *request, char **const headers)
  * Find the right service for a request
  */
 SERVICE *
-get_service(const LISTENER *lstn, const char *request, char **const headers)
+get_service(const LISTENER *lstn, const char *request, const HEADERS *headers)
 {
     SERVICE *svc;
 
@@ -522,80 +595,516 @@ get_REQUEST(char *res, const SERVICE *svc, const char *request)
 }
 
 static int
-get_HEADERS(char *res, const SERVICE *svc, char **const headers)
+get_HEADERS(char *res, const SERVICE *svc, const HEADERS *headers)
 {
     int         i, n, s;
     regmatch_t  matches[4];
 
     /* this will match SESS_COOKIE, SESS_HEADER and SESS_BASIC */
     res[0] = '\0';
-    for(i = 0; i < (MAXHEADERS - 1); i++) {
-        if(headers[i] == NULL)
-            continue;
-        if(regexec(&svc->sess_start, headers[i], 4, matches, 0))
+    for(i = 1; i < headers->n; i++) {
+        if(regexec(&svc->sess_start, HDR(headers, i), 4, matches, 0))
             continue;
         s = matches[0].rm_eo;
-        if(regexec(&svc->sess_pat, headers[i] + s, 4, matches, 0))
+        if(regexec(&svc->sess_pat, HDR(headers, i) + s, 4, matches, 0))
             continue;
         if((n = matches[1].rm_eo - matches[1].rm_so) > KEY_SIZE)
             n = KEY_SIZE;
-        strncpy(res, headers[i] + s + matches[1].rm_so, n);
+        strncpy(res, HDR(headers, i) + s + matches[1].rm_so, n);
         res[n] = '\0';
     }
     return res[0] != '\0';
 }
 
 /*
- * Pick a random back-end from a candidate list
+ * Back-end snapshots
+ *
+ * The back-ends a service may use (alive and enabled), with the alias table
+ * for random picks, the round-robin order and the consistent-hash table, are
+ * published as an immutable
+ * BE_SET. kill_be() builds a new one and swaps it in; requests pick from the
+ * current one without taking any lock.
+ *
+ * A replaced set is freed once no thread can still be using it (epoch-based
+ * reclamation): a thread announces the epoch in its slot before it looks at
+ * the set and clears it when done; a set retired in epoch E is freed when no
+ * slot shows an epoch <= E.
  */
-static BACKEND *
-rand_backend(BACKEND *be, int pri)
+typedef struct _ep_slot {
+    unsigned long   epoch;      /* epoch announced (0: not using any set) */
+    int             used;       /* taken by a thread */
+    struct _ep_slot *next;
+}   EP_SLOT;
+
+static unsigned long    ep_global = 1;
+static EP_SLOT          *ep_slots = NULL;
+static int              ep_nomem = 0;   /* a thread could not get a slot: reclaim nothing */
+static pthread_key_t    ep_key;
+static pthread_once_t   ep_once = PTHREAD_ONCE_INIT;
+static __thread EP_SLOT *ep_mine = NULL;
+
+static BE_SET           *retired = NULL;
+static pthread_mutex_t  retired_mut = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+ep_release(void *arg)
 {
-    while(be) {
-        if(!be->alive || be->disabled) {
-            be = be->next;
-            continue;
-        }
-        if((pri -= be->priority) < 0)
+    EP_SLOT *slot;
+
+    slot = (EP_SLOT *)arg;
+    __atomic_store_n(&slot->epoch, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&slot->used, 0, __ATOMIC_RELEASE);
+    return;
+}
+
+static void
+ep_init(void)
+{
+    pthread_key_create(&ep_key, ep_release);
+    return;
+}
+
+/*
+ * the slot of the calling thread (taken on first use, given back when the thread exits)
+ */
+static EP_SLOT *
+ep_slot(void)
+{
+    EP_SLOT *slot;
+
+    if(ep_mine != NULL)
+        return ep_mine;
+    pthread_once(&ep_once, ep_init);
+    for(slot = __atomic_load_n(&ep_slots, __ATOMIC_ACQUIRE); slot; slot = slot->next)
+        if(!__atomic_load_n(&slot->used, __ATOMIC_RELAXED) && !__atomic_exchange_n(&slot->used, 1, __ATOMIC_ACQUIRE))
             break;
-        be = be->next;
+    if(slot == NULL) {
+        if((slot = (EP_SLOT *)calloc(1, sizeof(EP_SLOT))) == NULL) {
+            logmsg(LOG_WARNING, "(%lx) ep_slot(): out of memory", pthread_self());
+            __atomic_store_n(&ep_nomem, 1, __ATOMIC_SEQ_CST);
+            return NULL;
+        }
+        slot->used = 1;
+        slot->next = __atomic_load_n(&ep_slots, __ATOMIC_RELAXED);
+        while(!__atomic_compare_exchange_n(&ep_slots, &slot->next, slot, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
     }
-    return be;
+    pthread_setspecific(ep_key, slot);
+    return ep_mine = slot;
 }
 
 /*
- * return a back-end based on a fixed hash value
- * this is used for session_ttl < 0
- * 
- * WARNING: the function may return different back-ends
- * if the target back-end is disabled or not alive
+ * the current set of a service, safe to use until set_leave()
+ */
+static BE_SET *
+set_enter(SERVICE *const svc)
+{
+    EP_SLOT *slot;
+
+    if((slot = ep_slot()) != NULL)
+        __atomic_store_n(&slot->epoch, __atomic_load_n(&ep_global, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&svc->live, __ATOMIC_SEQ_CST);
+}
+
+static void
+set_leave(void)
+{
+    if(ep_mine != NULL)
+        __atomic_store_n(&ep_mine->epoch, 0, __ATOMIC_RELEASE);
+    return;
+}
+
+static void
+set_free(BE_SET *set)
+{
+    if(set->be != NULL)
+        free(set->be);
+    if(set->prob != NULL)
+        free(set->prob);
+    if(set->alias != NULL)
+        free(set->alias);
+    if(set->hash_tab != NULL)
+        free(set->hash_tab);
+    if(set->rr != NULL)
+        free(set->rr);
+    free(set);
+    return;
+}
+
+/*
+ * free the retired sets nobody can be using any more
+ */
+void
+be_reclaim(void)
+{
+    BE_SET          *set, **prev;
+    EP_SLOT         *slot;
+    unsigned long   oldest, epoch;
+    int             ret_val;
+
+    if(__atomic_load_n(&retired, __ATOMIC_RELAXED) == NULL || __atomic_load_n(&ep_nomem, __ATOMIC_RELAXED))
+        return;
+    if(ret_val = pthread_mutex_lock(&retired_mut))
+        logmsg(LOG_WARNING, "be_reclaim() lock: %s", strerror(ret_val));
+    oldest = ~0UL;
+    for(slot = __atomic_load_n(&ep_slots, __ATOMIC_ACQUIRE); slot; slot = slot->next)
+        if((epoch = __atomic_load_n(&slot->epoch, __ATOMIC_SEQ_CST)) != 0 && epoch < oldest)
+            oldest = epoch;
+    for(prev = &retired; (set = *prev) != NULL; )
+        if(set->epoch < oldest) {
+            *prev = set->next;
+            set_free(set);
+        } else
+            prev = &set->next;
+    if(ret_val = pthread_mutex_unlock(&retired_mut))
+        logmsg(LOG_WARNING, "be_reclaim() unlock: %s", strerror(ret_val));
+    return;
+}
+
+#define EWMA_WEIGHT 8       /* each answer moves the average 1/8 of the way */
+#define LT_DECAY    10000   /* msec */
+
+/*
+ * the average response time of a back-end, decayed (halved every LT_DECAY msec)
+ * since its last answer; 0 if it has none
+ */
+static double
+lt_avg(BACKEND *const be, const unsigned long now)
+{
+    double          avg;
+    unsigned long   age;
+
+    __atomic_load(&be->t_average, &avg, __ATOMIC_RELAXED);
+    age = now - __atomic_load_n(&be->t_stamp, __ATOMIC_RELAXED);
+    if(age >= 64 * LT_DECAY)
+        return 0.0;
+    for(; age >= LT_DECAY; age -= LT_DECAY)
+        avg /= 2;
+    return avg;
+}
+
+/*
+ * Pick the back-end that answers fastest for its priority and load
+ *
+ * The cost is the average response time times the requests in progress (plus
+ * the new one): the picks made before a back-end's next answer updates its
+ * average spread over the others instead of all going to the fastest one. The
+ * average of a back-end that got no requests for a while decays, so a
+ * back-end that was slow once gets tried again. A back-end without an average
+ * (new, or unused for long) counts as fast as the fastest one, so that its
+ * requests in progress still count. Ties are broken at random.
+ */
+static BACKEND *
+lt_backend(const BE_SET *set)
+{
+    BACKEND         *be, *res;
+    double          avg, cost, best, fastest;
+    unsigned long   now;
+    int             i, n_best;
+
+    now = mono_ms();
+    for(fastest = 0.0, i = 0; i < set->n; i++)
+        if((avg = lt_avg(set->be[i], now)) > 0.0 && (fastest == 0.0 || avg < fastest))
+            fastest = avg;
+    if(fastest == 0.0)
+        /* no averages at all: just the load */
+        fastest = 1.0;
+    res = NULL;
+    best = 0.0;
+    n_best = 0;
+    for(i = 0; i < set->n; i++) {
+        be = set->be[i];
+        if((avg = lt_avg(be, now)) == 0.0)
+            avg = fastest;
+        cost = avg * (__atomic_load_n(&be->n_active, __ATOMIC_RELAXED) + 1) / be->priority;
+        if(res == NULL || cost < best) {
+            res = be;
+            best = cost;
+            n_best = 1;
+        } else if(cost == best && be_rand() % ++n_best == 0)
+            res = be;
+    }
+    return res;
+}
+
+/*
+ * Pick the less busy (requests in progress for its priority) of two random back-ends
+ *
+ * Two random candidates rather than a scan of all of them: cheap on large
+ * pools, and the threads that pick at the same time do not all pile onto the
+ * one back-end that looks least busy.
+ */
+static BACKEND *
+lc_backend(const BE_SET *set)
+{
+    BACKEND *a, *b;
+    int     n_a, n_b;
+
+    a = rand_backend(set);
+    if(set->n < 2)
+        return a;
+    /* the second one is another back-end (a few tries at most, unless a is most of the weight) */
+    do
+        b = rand_backend(set);
+    while(b == a);
+    n_a = __atomic_load_n(&a->n_active, __ATOMIC_RELAXED);
+    n_b = __atomic_load_n(&b->n_active, __ATOMIC_RELAXED);
+    return n_b * a->priority < n_a * b->priority? b: a;
+}
+
+/*
+ * Smooth weighted round-robin (as in nginx): every pick adds each back-end's
+ * priority to its credit, takes the back-end with the most credit and charges
+ * it the total priority. The order repeats every tot_pri picks, so it is
+ * computed once per set; requests just step through it with an atomic counter.
+ */
+#define RR_MAX_WORK 4194304 /* max. n * tot_pri: above it RoundRobin picks at random */
+
+static int *
+rr_build(const BE_SET *set)
+{
+    int *seq, *credit, i, k, best;
+
+    if((seq = (int *)malloc(set->tot_pri * sizeof(int))) == NULL)
+        return NULL;
+    if((credit = (int *)calloc(set->n, sizeof(int))) == NULL) {
+        free(seq);
+        return NULL;
+    }
+    for(k = 0; k < set->tot_pri; k++) {
+        for(best = i = 0; i < set->n; i++)
+            if((credit[i] += set->be[i]->priority) > credit[best])
+                best = i;
+        credit[best] -= set->tot_pri;
+        seq[k] = best;
+    }
+    free(credit);
+    return seq;
+}
+
+static BACKEND *
+rr_backend(SERVICE *const svc, const BE_SET *set)
+{
+    if(set->rr == NULL)
+        return rand_backend(set);
+    return set->be[set->rr[__atomic_fetch_add(&svc->rr_next, 1, __ATOMIC_RELAXED) % set->tot_pri]];
+}
+
+/*
+ * Pick a back-end for a new request, as the service balances them
  */
 static BACKEND *
-hash_backend(BACKEND *be, int abs_pri, char *key)
+pick_backend(SERVICE *const svc, const BE_SET *set)
+{
+    switch(svc->balance) {
+    case BAL_LEASTTIME:
+        return lt_backend(set);
+    case BAL_LEASTCONN:
+        return lc_backend(set);
+    case BAL_ROUNDROBIN:
+        return rr_backend(svc, set);
+    default:
+        return rand_backend(set);
+    }
+}
+
+/*
+ * Consistent hashing (Session TTL < 0)
+ *
+ * Every service with hashed sessions has a Maglev lookup table: the alive
+ * back-ends take turns, each taking the next free slot in its own pseudo-random
+ * order, until the table is full. A back-end earns a turn for every max.
+ * priority worth of credit, so it gets slots in proportion to its priority
+ * whatever its place in the configuration. A key maps to one slot, so when a
+ * back-end comes or goes only the keys on its slots move. The table size
+ * depends on the configured back-ends only, never on which ones are alive.
+ */
+#define HASH_SLOTS  100     /* table slots per configured back-end */
+
+/*
+ * the smallest prime not below n
+ */
+static int
+next_prime(int n)
+{
+    int i;
+
+    if(n <= 2)
+        return 2;
+    for(n |= 1;; n += 2) {
+        for(i = 3; i * i <= n && n % i; i += 2)
+            ;
+        if(i * i > n)
+            return n;
+    }
+}
+
+static unsigned long
+hash_key(const char *key)
 {
     unsigned long   hv;
-    BACKEND         *res, *tb;
-    int             pri;
 
     hv = 2166136261;
     while(*key)
-        hv = ((hv ^ *key++) * 16777619) & 0xFFFFFFFF;
-    pri = hv % abs_pri;
-    for(tb = be; tb; tb = tb->next)
-        if((pri -= tb->priority) < 0)
-            break;
-    if(!tb)
-        /* should NEVER happen */
+        hv = ((hv ^ (unsigned char)*key++) * 16777619) & 0xFFFFFFFF;
+    return hv;
+}
+
+static unsigned long
+hash_mix(unsigned long hv)
+{
+    hv = ((hv ^ (hv >> 16)) * 0x85EBCA6B) & 0xFFFFFFFF;
+    hv = ((hv ^ (hv >> 13)) * 0xC2B2AE35) & 0xFFFFFFFF;
+    return hv ^ (hv >> 16);
+}
+
+/*
+ * build the hash table of a set (NULL if out of memory)
+ */
+static BACKEND **
+hash_build(const BE_SET *set)
+{
+    BACKEND         *be, **tab;
+    unsigned long   *perm, hv;
+    char            buf[MAXBUF];
+    int             filled, max_pri, i;
+
+    /* per back-end: offset, skip, next in its order of slots and credit */
+    if((tab = (BACKEND **)calloc(set->hash_size, sizeof(BACKEND *))) == NULL)
+        return NULL;
+    if((perm = (unsigned long *)malloc(4 * set->n * sizeof(unsigned long))) == NULL) {
+        free(tab);
         return NULL;
-    for(res = tb; !res->alive || res->disabled; ) {
-        res = res->next;
-        if(res == NULL)
-            res = be;
-        if(res == tb)
-            /* NO back-end available */
-            return NULL;
     }
-    return res;
+    for(max_pri = 1, i = 0; i < set->n; i++) {
+        be = set->be[i];
+        /* the order depends on the back-end, not on its place in the configuration */
+        if(be->name != NULL)
+            hv = hash_key(be->name);
+        else if(be->be_type)
+            hv = hash_key(be->url);
+        else {
+            str_be(buf, MAXBUF - 1, be);
+            hv = hash_key(buf);
+        }
+        perm[4 * i] = hv % set->hash_size;
+        perm[4 * i + 1] = hash_mix(hv) % (set->hash_size - 1) + 1;
+        perm[4 * i + 2] = perm[4 * i + 3] = 0;
+        if(be->priority > max_pri)
+            max_pri = be->priority;
+    }
+    /* one slot per turn, so that a partial last round favours nobody */
+    for(filled = 0; filled < set->hash_size; )
+        for(i = 0; i < set->n && filled < set->hash_size; i++) {
+            if((perm[4 * i + 3] += set->be[i]->priority) < max_pri)
+                continue;
+            perm[4 * i + 3] -= max_pri;
+            do
+                hv = (perm[4 * i] + perm[4 * i + 2]++ * perm[4 * i + 1]) % set->hash_size;
+            while(tab[hv] != NULL);
+            tab[hv] = set->be[i];
+            filled++;
+        }
+    free(perm);
+    return tab;
+}
+
+/*
+ * return the back-end for a key
+ *
+ * With HashLoad a back-end takes a new request only while its requests in
+ * progress are below HashLoad percent of its share; otherwise the next slots
+ * in the table are tried.
+ */
+static BACKEND *
+hash_backend(SERVICE *const svc, const BE_SET *set, const char *key)
+{
+    BACKEND         *res, *prev;
+    unsigned long   slot;
+    long            tot;
+    int             i;
+
+    slot = hash_mix(hash_key(key)) % set->hash_size;
+    if(svc->hash_load <= 0)
+        return set->hash_tab[slot];
+    for(tot = 0, i = 0; i < set->n; i++)
+        tot += __atomic_load_n(&set->be[i]->n_active, __ATOMIC_RELAXED);
+    for(prev = NULL, i = 0; i < set->hash_size; i++) {
+        if((res = set->hash_tab[(slot + i) % set->hash_size]) == prev)
+            continue;
+        if(__atomic_load_n(&res->n_active, __ATOMIC_RELAXED) * 100L * set->tot_pri
+        < (tot + 1) * svc->hash_load * res->priority)
+            return res;
+        prev = res;
+    }
+    return set->hash_tab[slot];
+}
+
+/*
+ * a new set from the alive and enabled back-ends of a service (NULL if out of memory)
+ */
+static BE_SET *
+set_new(SERVICE *const svc)
+{
+    BE_SET  *set;
+    BACKEND *be;
+    int     n, n_all;
+
+    if((set = (BE_SET *)calloc(1, sizeof(BE_SET))) == NULL)
+        return NULL;
+    for(n = n_all = 0, be = svc->backends; be; be = be->next, n_all++)
+        if(be->alive && !be->disabled)
+            n++;
+    if(svc->sess_ttl < 0)
+        set->hash_size = next_prime(HASH_SLOTS * n_all);
+    if((set->be = (BACKEND **)calloc(n + 1, sizeof(BACKEND *))) == NULL
+    || (set->prob = (int *)calloc(n + 1, sizeof(int))) == NULL
+    || (set->alias = (int *)calloc(n + 1, sizeof(int))) == NULL) {
+        set_free(set);
+        return NULL;
+    }
+    for(be = svc->backends; be; be = be->next)
+        if(be->alive && !be->disabled) {
+            set->be[set->n++] = be;
+            set->tot_pri += be->priority;
+        }
+    if(set->n > 0 && alias_build(set)
+    || svc->sess_ttl < 0 && set->n > 0 && (set->hash_tab = hash_build(set)) == NULL
+    || svc->balance == BAL_ROUNDROBIN && set->n > 0 && (long)set->n * set->tot_pri <= RR_MAX_WORK
+        && (set->rr = rr_build(set)) == NULL) {
+        set_free(set);
+        return NULL;
+    }
+    return set;
+}
+
+/*
+ * publish a new set for a service
+ * (called with the service locked, or before any threads run)
+ * returns -1 if out of memory: the old set (if any) stays
+ */
+int
+be_publish(SERVICE *const svc)
+{
+    BE_SET  *set, *old;
+    int     ret_val;
+
+    if((set = set_new(svc)) == NULL) {
+        /* keep the old set: better than nothing */
+        logmsg(LOG_WARNING, "(%lx) be_publish(): out of memory", pthread_self());
+        return -1;
+    }
+    if((old = __atomic_exchange_n(&svc->live, set, __ATOMIC_SEQ_CST)) == NULL)
+        return 0;
+    if(ret_val = pthread_mutex_lock(&retired_mut))
+        logmsg(LOG_WARNING, "be_publish() lock: %s", strerror(ret_val));
+    old->epoch = __atomic_fetch_add(&ep_global, 1, __ATOMIC_SEQ_CST);
+    old->next = retired;
+    __atomic_store_n(&retired, old, __ATOMIC_RELAXED);
+    if(ret_val = pthread_mutex_unlock(&retired_mut))
+        logmsg(LOG_WARNING, "be_publish() unlock: %s", strerror(ret_val));
+    be_reclaim();
+    return 0;
 }
 
 static void identify_backend(BACKEND *p)
@@ -609,88 +1118,72 @@ static void identify_backend(BACKEND *p)
 
 /*
  * Find the right back-end for a request
+ *
+ * Only sessions kept in the session table need the service lock.
  */
 BACKEND *
-get_backend(SERVICE *const svc, const struct addrinfo *from_host, const char *request, char **const headers)
+get_backend(SERVICE *const svc, const struct addrinfo *from_host, const char *request, const HEADERS *headers)
 {
     BACKEND     *res;
+    BE_SET      *set;
     char        key[KEY_SIZE + 1];
-    int         ret_val, no_be;
+    int         ret_val, has_key;
     void        *vp;
 
-    if(ret_val = pthread_mutex_lock(&svc->mut))
-        logmsg(LOG_WARNING, "get_backend() lock: %s", strerror(ret_val));
-
     fprintf(stderr, "%s: request %s\n",  __func__, request);
-    no_be = (svc->tot_pri <= 0);
 
     if(svc->lookup_backend) {
+        if(ret_val = pthread_mutex_lock(&svc->mut))
+            logmsg(LOG_WARNING, "get_backend() lock: %s", strerror(ret_val));
 	res = (BACKEND *) (*svc->lookup_backend)(svc->backends, request);
 	fprintf(stderr, "lookup returned %p\n", res);
-    } else {
-	    switch(svc->sess_type) {
-	    case SESS_NONE:
-		/* choose one back-end randomly */
-		res = no_be? svc->emergency: rand_backend(svc->backends, random() % svc->tot_pri);
-		break;
-	    case SESS_IP:
-		addr2str(key, KEY_SIZE, from_host, 1);
-		if(svc->sess_ttl < 0)
-		    res = no_be? svc->emergency: hash_backend(svc->backends, svc->abs_pri, key);
-		else if((vp = t_find(svc->sessions, key)) == NULL) {
-		    if(no_be)
-			res = svc->emergency;
-		    else {
-			/* no session yet - create one */
-			res = rand_backend(svc->backends, random() % svc->tot_pri);
-			t_add(svc->sessions, key, &res, sizeof(res));
-		    }
-		} else
-		    memcpy(&res, vp, sizeof(res));
-		break;
-	    case SESS_URL:
-	    case SESS_PARM:
-		if(get_REQUEST(key, svc, request)) {
-		    if(svc->sess_ttl < 0)
-			res = no_be? svc->emergency: hash_backend(svc->backends, svc->abs_pri, key);
-		    else if((vp = t_find(svc->sessions, key)) == NULL) {
-			if(no_be)
-			    res = svc->emergency;
-			else {
-			    /* no session yet - create one */
-			    res = rand_backend(svc->backends, random() % svc->tot_pri);
-			    t_add(svc->sessions, key, &res, sizeof(res));
-			}
-		    } else
-			memcpy(&res, vp, sizeof(res));
-		} else {
-		    res = no_be? svc->emergency: rand_backend(svc->backends, random() % svc->tot_pri);
-		}
-		break;
-	    default:
-		/* this works for SESS_BASIC, SESS_HEADER and SESS_COOKIE */
-		if(get_HEADERS(key, svc, headers)) {
-		    if(svc->sess_ttl < 0)
-			res = no_be? svc->emergency: hash_backend(svc->backends, svc->abs_pri, key);
-		    else if((vp = t_find(svc->sessions, key)) == NULL) {
-			if(no_be)
-			    res = svc->emergency;
-			else {
-			    /* no session yet - create one */
-			    res = rand_backend(svc->backends, random() % svc->tot_pri);
-			    t_add(svc->sessions, key, &res, sizeof(res));
-			}
-		    } else
-			memcpy(&res, vp, sizeof(res));
-		} else {
-		    res = no_be? svc->emergency: rand_backend(svc->backends, random() % svc->tot_pri);
-		}
-		break;
-	    }
+        if(ret_val = pthread_mutex_unlock(&svc->mut))
+            logmsg(LOG_WARNING, "get_backend() unlock: %s", strerror(ret_val));
+        identify_backend(res);
+        return res;
     }
 
-    if(ret_val = pthread_mutex_unlock(&svc->mut))
-        logmsg(LOG_WARNING, "get_backend() unlock: %s", strerror(ret_val));
+    switch(svc->sess_type) {
+    case SESS_NONE:
+        has_key = 0;
+        break;
+    case SESS_IP:
+        addr2str(key, KEY_SIZE, from_host, 1);
+        has_key = 1;
+        break;
+    case SESS_URL:
+    case SESS_PARM:
+        has_key = get_REQUEST(key, svc, request);
+        break;
+    default:
+        /* this works for SESS_BASIC, SESS_HEADER and SESS_COOKIE */
+        has_key = get_HEADERS(key, svc, headers);
+        break;
+    }
+
+    set = set_enter(svc);
+    if(!has_key)
+        /* choose one back-end as the service balances them */
+        res = set->n > 0? pick_backend(svc, set): svc->emergency;
+    else if(svc->sess_ttl < 0)
+        res = set->n > 0? hash_backend(svc, set, key): svc->emergency;
+    else {
+        if(ret_val = pthread_mutex_lock(&svc->mut))
+            logmsg(LOG_WARNING, "get_backend() lock: %s", strerror(ret_val));
+        if((vp = t_find(svc->sessions, key)) == NULL) {
+            if(set->n == 0)
+                res = svc->emergency;
+            else {
+                /* no session yet - create one */
+                res = pick_backend(svc, set);
+                t_add(svc->sessions, key, &res, sizeof(res));
+            }
+        } else
+            memcpy(&res, vp, sizeof(res));
+        if(ret_val = pthread_mutex_unlock(&svc->mut))
+            logmsg(LOG_WARNING, "get_backend() unlock: %s", strerror(ret_val));
+    }
+    set_leave();
 
     identify_backend(res);
     return res;
@@ -700,7 +1193,7 @@ get_backend(SERVICE *const svc, const struct addrinfo *from_host, const char *re
  * (for cookies/header only) possibly create session based on response headers
  */
 void
-upd_session(SERVICE *const svc, char **const headers, BACKEND *const be)
+upd_session(SERVICE *const svc, const HEADERS *headers, BACKEND *const be)
 {
     char            key[KEY_SIZE + 1];
     int             ret_val;
@@ -717,24 +1210,133 @@ upd_session(SERVICE *const svc, char **const headers, BACKEND *const be)
     return;
 }
 
+/*
+ * Outlier detection: count the responses of each back-end per second, in
+ * OD_WINDOW slots. The thread that moves a slot to a new second clears it, so a
+ * response counted at that very moment may get lost - good enough for rates.
+ */
+#define OD_MAX_SHIFT    5   /* the ejection time doubles at most this often */
+
+static void
+od_update(SERVICE *const svc, BACKEND *const be, const double elapsed, const int code)
+{
+    OUTLIER *od;
+    OD_SLOT *slot;
+    time_t  now, sec;
+    int     err, slow, n_req, n_err, n_slow, i;
+    char    buf[MAXBUF];
+
+    od = svc->outlier;
+    now = time(NULL);
+    err = code == 0 || code >= 500;
+    slow = od->slow_ms > 0 && elapsed > od->slow_ms * 1000.0;
+    slot = &be->od[now % OD_WINDOW];
+    sec = __atomic_load_n(&slot->sec, __ATOMIC_RELAXED);
+    if(sec < now && __atomic_compare_exchange_n(&slot->sec, &sec, now, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&slot->n_req, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->n_err, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->n_slow, 0, __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&slot->n_req, 1, __ATOMIC_RELAXED);
+    if(err)
+        __atomic_add_fetch(&slot->n_err, 1, __ATOMIC_RELAXED);
+    if(slow)
+        __atomic_add_fetch(&slot->n_slow, 1, __ATOMIC_RELAXED);
+
+    if(!err) {
+        __atomic_store_n(&be->od_fails, 0, __ATOMIC_RELAXED);
+        if(!slow)
+            return;
+    } else if(od->errors > 0 && __atomic_add_fetch(&be->od_fails, 1, __ATOMIC_RELAXED) >= od->errors) {
+        __atomic_store_n(&be->od_fails, 0, __ATOMIC_RELAXED);
+        str_be(buf, MAXBUF - 1, be);
+        logmsg(LOG_NOTICE, "(%lx) BackEnd %s is an outlier: %d errors in a row", pthread_self(), buf, od->errors);
+        kill_be(svc, be, BE_EJECT);
+        return;
+    }
+
+    /* the rates: at most once a second per back-end */
+    if(od->err_rate <= 0 && od->slow_rate <= 0)
+        return;
+    sec = __atomic_load_n(&be->od_checked, __ATOMIC_RELAXED);
+    if(sec >= now || !__atomic_compare_exchange_n(&be->od_checked, &sec, now, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        return;
+    /* only what came back since the last ejection counts */
+    for(n_req = n_err = n_slow = i = 0; i < OD_WINDOW; i++) {
+        slot = &be->od[i];
+        sec = __atomic_load_n(&slot->sec, __ATOMIC_RELAXED);
+        if(sec <= now - OD_WINDOW || sec < __atomic_load_n(&be->eject_until, __ATOMIC_RELAXED))
+            continue;
+        n_req += __atomic_load_n(&slot->n_req, __ATOMIC_RELAXED);
+        n_err += __atomic_load_n(&slot->n_err, __ATOMIC_RELAXED);
+        n_slow += __atomic_load_n(&slot->n_slow, __ATOMIC_RELAXED);
+    }
+    if(n_req < od->min_req || n_req <= 0)
+        return;
+    if(od->err_rate > 0 && n_err * 100 >= od->err_rate * n_req) {
+        str_be(buf, MAXBUF - 1, be);
+        logmsg(LOG_NOTICE, "(%lx) BackEnd %s is an outlier: %d of %d responses failed", pthread_self(), buf,
+            n_err, n_req);
+        kill_be(svc, be, BE_EJECT);
+    } else if(od->slow_rate > 0 && n_slow * 100 >= od->slow_rate * n_req) {
+        str_be(buf, MAXBUF - 1, be);
+        logmsg(LOG_NOTICE, "(%lx) BackEnd %s is an outlier: %d of %d responses took over %d msec", pthread_self(),
+            buf, n_slow, n_req, od->slow_ms);
+        kill_be(svc, be, BE_EJECT);
+    }
+    return;
+}
+
+/*
+ * record the time a back-end took to answer (usec) in its moving average
+ */
+void
+upd_be(SERVICE *const svc, BACKEND *const be, const double elapsed, const int code)
+{
+    double  old, avg;
+
+    __atomic_load(&be->t_average, &old, __ATOMIC_RELAXED);
+    do
+        avg = old > 0.0? old + (elapsed - old) / EWMA_WEIGHT: elapsed;
+    while(!__atomic_compare_exchange(&be->t_average, &old, &avg, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    __atomic_add_fetch(&be->n_requests, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&be->t_stamp, mono_ms(), __ATOMIC_RELAXED);
+    if(svc->outlier != NULL)
+        od_update(svc, be, elapsed, code);
+    return;
+}
+
 /*
  * mark a backend host as dead/disabled; remove its sessions if necessary
  *  disable_only == 1:  mark as disabled
  *  disable_only == 0:  mark as dead, remove sessions
  *  disable_only == -1:  mark as enabled
+ *  BE_EJECT: mark as dead for a while (an outlier), unless too many are out already
+ *  BE_RESURRECT: mark as alive, unless still ejected
  */
 void
 kill_be(SERVICE *const svc, const BACKEND *be, const int disable_mode)
 {
     BACKEND *b;
-    int     ret_val;
+    int     ret_val, was_up, changed, n_be, n_out, secs;
+    time_t  now;
     char    buf[MAXBUF];
 
     if(ret_val = pthread_mutex_lock(&svc->mut))
         logmsg(LOG_WARNING, "kill_be() lock: %s", strerror(ret_val));
+    now = time(NULL);
+    for(n_be = n_out = 0, b = svc->backends; b; b = b->next)
+        if(!b->be_type) {
+            n_be++;
+            /* out until resurrected, also once its ejection time is over */
+            if(b->ejected && !b->alive)
+                n_out++;
+        }
     svc->tot_pri = 0;
+    changed = 0;
     for(b = svc->backends; b; b = b->next) {
-        if(b == be)
+        if(b == be) {
+            was_up = b->alive && !b->disabled;
             switch(disable_mode) {
             case BE_DISABLE:
                 b->disabled = 1;
@@ -752,13 +1354,48 @@ kill_be(SERVICE *const svc, const BACKEND *be, const int disable_mode)
                 logmsg(LOG_NOTICE, "(%lx) BackEnd %s enabled", pthread_self(), buf);
                 b->disabled = 0;
                 break;
+            case BE_EJECT:
+                if(!b->alive || svc->outlier == NULL)
+                    break;
+                str_be(buf, MAXBUF - 1, b);
+                if(n_out > 0 && (n_out + 1) * 100 > svc->outlier->max_eject * n_be) {
+                    logmsg(LOG_NOTICE, "(%lx) BackEnd %s not ejected: %d of %d back-ends are out already",
+                        pthread_self(), buf, n_out, n_be);
+                    break;
+                }
+                secs = svc->outlier->eject << (b->n_eject < OD_MAX_SHIFT? b->n_eject: OD_MAX_SHIFT);
+                /* back in service for longer than this ejection would last: start over */
+                if(now - b->eject_until > secs) {
+                    b->n_eject = 0;
+                    secs = svc->outlier->eject;
+                }
+                b->n_eject++;
+                __atomic_store_n(&b->eject_until, now + secs, __ATOMIC_RELAXED);
+                b->alive = 0;
+                b->ejected = 1;
+                logmsg(LOG_NOTICE, "(%lx) BackEnd %s ejected for %d secs", pthread_self(), buf, secs);
+                t_clean(svc->sessions, &be, sizeof(be));
+                break;
+            case BE_RESURRECT:
+                if(!b->alive && b->eject_until <= now) {
+                    b->alive = 1;
+                    b->ejected = 0;
+                    str_be(buf, MAXBUF - 1, b);
+                    logmsg(LOG_NOTICE, "(%lx) BackEnd %s resurrect", pthread_self(), buf);
+                }
+                break;
             default:
                 logmsg(LOG_WARNING, "kill_be(): unknown mode %d", disable_mode);
                 break;
             }
+            changed = was_up != (b->alive && !b->disabled);
+        }
         if(b->alive && !b->disabled)
             svc->tot_pri += b->priority;
     }
+    /* membership changes are rare: requests only look the set up */
+    if(changed)
+        (void)be_publish(svc);
     if(ret_val = pthread_mutex_unlock(&svc->mut))
         logmsg(LOG_WARNING, "kill_be() unlock: %s", strerror(ret_val));
     return;
@@ -1005,239 +1642,6 @@ connect_nb(const int sockfd, const struct addrinfo *serv_addr, const int to)
     return 0;
 }
 
-/*
- * Check if dead hosts returned to life;
- * runs every alive seconds
- */
-static void
-do_resurect(void)
-{
-    LISTENER    *lstn;
-    SERVICE     *svc;
-    BACKEND     *be;
-    struct      addrinfo    z_addr, *addr;
-    int         sock, modified;
-    char        buf[MAXBUF];
-    int         ret_val;
-
-    /* check hosts still alive - HAport */
-    memset(&z_addr, 0, sizeof(z_addr));
-    for(lstn = listeners; lstn; lstn = lstn->next)
-    for(svc = lstn->services; svc; svc = svc->next)
-    for(be = svc->backends; be; be = be->next) {
-        if(be->be_type)
-            continue;
-        if(!be->alive)
-            /* already dead */
-            continue;
-        if(memcmp(&(be->ha_addr), &z_addr, sizeof(z_addr)) == 0)
-            /* no HA port */
-            continue;
-        /* try connecting */
-        switch(be->ha_addr.ai_family) {
-        case AF_INET:
-            if((sock = socket(PF_INET, SOCK_STREAM, 0)) < 0)
-                continue;
-            break;
-        case AF_INET6:
-            if((sock = socket(PF_INET6, SOCK_STREAM, 0)) < 0)
-                continue;
-            break;
-        case AF_UNIX:
-            if((sock = socket(PF_UNIX, SOCK_STREAM, 0)) < 0)
-                continue;
-            break;
-        default:
-            continue;
-        }
-        if(connect_nb(sock, &be->ha_addr, be->conn_to) != 0) {
-            kill_be(svc, be, BE_KILL);
-            str_be(buf, MAXBUF - 1, be);
-            logmsg(LOG_NOTICE, "BackEnd %s is dead (HA)", buf);
-        }
-        shutdown(sock, 2);
-        close(sock);
-    }
-
-    for(svc = services; svc; svc = svc->next)
-    for(be = svc->backends; be; be = be->next) {
-        if(be->be_type)
-            continue;
-        if(!be->alive)
-            /* already dead */
-            continue;
-        if(memcmp(&(be->ha_addr), &z_addr, sizeof(z_addr)) == 0)
-            /* no HA port */
-            continue;
-        /* try connecting */
-        switch(be->ha_addr.ai_family) {
-        case AF_INET:
-            if((sock = socket(PF_INET, SOCK_STREAM, 0)) < 0)
-                continue;
-            break;
-        case AF_INET6:
-            if((sock = socket(PF_INET6, SOCK_STREAM, 0)) < 0)
-                continue;
-            break;
-        case AF_UNIX:
-            if((sock = socket(PF_UNIX, SOCK_STREAM, 0)) < 0)
-                continue;
-            break;
-        default:
-            continue;
-        }
-        if(connect_nb(sock, &be->ha_addr, be->conn_to) != 0) {
-            kill_be(svc, be, BE_KILL);
-            str_be(buf, MAXBUF - 1, be);
-            logmsg(LOG_NOTICE, "BackEnd %s is dead (HA)", buf);
-        }
-        shutdown(sock, 2);
-        close(sock);
-    }
-
-    /* check hosts alive again */
-    for(lstn = listeners; lstn; lstn = lstn->next)
-    for(svc = lstn->services; svc; svc = svc->next) {
-        for(modified = 0, be = svc->backends; be; be = be->next) {
-            be->resurrect = 0;
-            if(be->be_type)
-                continue;
-            if(be->alive)
-                continue;
-            if(memcmp(&(be->ha_addr), &z_addr, sizeof(z_addr)) == 0) {
-                switch(be->addr.ai_family) {
-                case AF_INET:
-                    if((sock = socket(PF_INET, SOCK_STREAM, 0)) < 0)
-                        continue;
-                    break;
-                case AF_INET6:
-                    if((sock = socket(PF_INET6, SOCK_STREAM, 0)) < 0)
-                        continue;
-                    break;
-                case AF_UNIX:
-                    if((sock = socket(PF_UNIX, SOCK_STREAM, 0)) < 0)
-                        continue;
-                    break;
-                default:
-                    continue;
-                }
-                addr = &be->addr;
-            } else {
-                switch(be->ha_addr.ai_family) {
-                case AF_INET:
-                    if((sock = socket(PF_INET, SOCK_STREAM, 0)) < 0)
-                        continue;
-                    break;
-                case AF_INET6:
-                    if((sock = socket(PF_INET6, SOCK_STREAM, 0)) < 0)
-                        continue;
-                    break;
-                case AF_UNIX:
-                    if((sock = socket(PF_UNIX, SOCK_STREAM, 0)) < 0)
-                        continue;
-                    break;
-                default:
-                    continue;
-                }
-                addr = &be->ha_addr;
-            }
-            if(connect_nb(sock, addr, be->conn_to) == 0) {
-                be->resurrect = 1;
-                modified = 1;
-            }
-            shutdown(sock, 2);
-            close(sock);
-        }
-        if(modified) {
-            if(ret_val = pthread_mutex_lock(&svc->mut))
-                logmsg(LOG_WARNING, "do_resurect() lock: %s", strerror(ret_val));
-            svc->tot_pri = 0;
-            for(be = svc->backends; be; be = be->next) {
-                if(be->resurrect) {
-                    be->alive = 1;
-                    str_be(buf, MAXBUF - 1, be);
-                    logmsg(LOG_NOTICE, "BackEnd %s resurrect", buf);
-                }
-                if(be->alive && !be->disabled)
-                    svc->tot_pri += be->priority;
-            }
-            if(ret_val = pthread_mutex_unlock(&svc->mut))
-                logmsg(LOG_WARNING, "do_resurect() unlock: %s", strerror(ret_val));
-        }
-    }
-
-    for(svc = services; svc; svc = svc->next) {
-        for(modified = 0, be = svc->backends; be; be = be->next) {
-            be->resurrect = 0;
-            if(be->be_type)
-                continue;
-            if(be->alive)
-                continue;
-            if(memcmp(&(be->ha_addr), &z_addr, sizeof(z_addr)) == 0) {
-                switch(be->addr.ai_family) {
-                case AF_INET:
-                    if((sock = socket(PF_INET, SOCK_STREAM, 0)) < 0)
-                        continue;
-                    break;
-                case AF_INET6:
-                    if((sock = socket(PF_INET6, SOCK_STREAM, 0)) < 0)
-                        continue;
-                    break;
-                case AF_UNIX:
-                    if((sock = socket(PF_UNIX, SOCK_STREAM, 0)) < 0)
-                        continue;
-                    break;
-                default:
-                    continue;
-                }
-                addr = &be->addr;
-            } else {
-                switch(be->ha_addr.ai_family) {
-                case AF_INET:
-                    if((sock = socket(PF_INET, SOCK_STREAM, 0)) < 0)
-                        continue;
-                    break;
-                case AF_INET6:
-                    if((sock = socket(PF_INET6, SOCK_STREAM, 0)) < 0)
-                        continue;
-                    break;
-                case AF_UNIX:
-                    if((sock = socket(PF_UNIX, SOCK_STREAM, 0)) < 0)
-                        continue;
-                    break;
-                default:
-                    continue;
-                }
-                addr = &be->ha_addr;
-            }
-            if(connect_nb(sock, addr, be->conn_to) == 0) {
-                be->resurrect = 1;
-                modified = 1;
-            }
-            shutdown(sock, 2);
-            close(sock);
-        }
-        if(modified) {
-            if(ret_val = pthread_mutex_lock(&svc->mut))
-                logmsg(LOG_WARNING, "do_resurect() lock: %s", strerror(ret_val));
-            svc->tot_pri = 0;
-            for(be = svc->backends; be; be = be->next) {
-                if(be->resurrect) {
-                    be->alive = 1;
-                    str_be(buf, MAXBUF - 1, be);
-                    logmsg(LOG_NOTICE, "BackEnd %s resurrect", buf);
-                }
-                if(be->alive && !be->disabled)
-                    svc->tot_pri += be->priority;
-            }
-            if(ret_val = pthread_mutex_unlock(&svc->mut))
-                logmsg(LOG_WARNING, "do_resurect() unlock: %s", strerror(ret_val));
-        }
-    }
-    
-    return;
-}
-
 /*
  * Remove expired sessions
  * runs every EXPIRE_TO seconds
@@ -1363,7 +1767,7 @@ DH_tmp_callback(/* not used */SSL *s, /* not used */int is_export, int keylength
     return keylength == 512? DH512_params : DHALT_params;
 }
 
-static time_t   last_RSA, last_alive, last_expire;
+static time_t   last_RSA, last_expire;
 
 /*
  * initialise the timer functions:
@@ -1374,7 +1778,7 @@ init_timer(void)
 {
     int n;
 
-    last_RSA = last_alive = last_expire = time(NULL);
+    last_RSA = last_expire = time(NULL);
 
     /*
      * Pre-generate ephemeral RSA keys
@@ -1405,20 +1809,23 @@ init_timer(void)
 /*
  * run timed functions:
  *  - RSAgen every T_RSA_KEYS seconds
- *  - resurect every alive_to seconds
  *  - expire every EXPIRE_TO seconds
+ *  - expire idle pooled back-end connections and free replaced back-end sets
+ *    every round (at most alive_to seconds, or the shortest PoolIdleTimeOut)
  */
 void *
 thr_timer(void *arg)
 {
     time_t  last_time, cur_time;
-    int     n_wait, n_remain;
+    int     n_wait, n_remain, pool_to;
 
     n_wait = EXPIRE_TO;
     if(n_wait > alive_to)
         n_wait = alive_to;
     if(n_wait > T_RSA_KEYS)
         n_wait = T_RSA_KEYS;
+    if((pool_to = be_pool_tick()) > 0 && n_wait > pool_to)
+        n_wait = pool_to;
     for(last_time = time(NULL) - n_wait;;) {
         cur_time = time(NULL);
         if((n_remain = n_wait - (cur_time - last_time)) > 0)
@@ -1428,14 +1835,12 @@ thr_timer(void *arg)
             last_RSA = time(NULL);
             do_RSAgen();
         }
-        if((last_time - last_alive) >= alive_to) {
-            last_alive = time(NULL);
-            do_resurect();
-        }
         if((last_time - last_expire) >= EXPIRE_TO) {
             last_expire = time(NULL);
             do_expire();
         }
+        be_pool_expire();
+        be_reclaim();
     }
 }
 
@@ -1565,6 +1970,7 @@ thr_control(void *arg)
     BACKEND         *be, dummy_be;
     TABNODE         dummy_sess;
     struct pollfd   polls;
+    POOL_STAT       pool;
 
     /* just to be safe */
     if(control_sock < 0)
@@ -1599,6 +2005,8 @@ thr_control(void *arg)
             /* logmsg(LOG_INFO, "thr_control() list"); */
             n = get_thr_qlen();
             (void)write(ctl, (void *)&n, sizeof(n));
+            get_pool_stat(&pool);
+            (void)write(ctl, (void *)&pool, sizeof(pool));
             for(lstn = listeners; lstn; lstn = lstn->next) {
                 (void)write(ctl, (void *)lstn, sizeof(LISTENER));
                 (void)write(ctl, lstn->addr.ai_addr, lstn->addr.ai_addrlen);
@@ -1721,6 +2129,52 @@ thr_control(void *arg)
     }
 }
 
+/*
+ * a new TLS session with a back-end (possibly a ticket received after the handshake):
+ * it replaces the one kept for resumption
+ */
+int
+be_new_session(SSL *ssl, SSL_SESSION *sess)
+{
+    BACKEND     *be;
+    SSL_SESSION *old;
+    int         ret_val;
+
+    if((be = (BACKEND *)SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl))) == NULL)
+        return 0;
+    if(ret_val = pthread_mutex_lock(&be->mut)) {
+        logmsg(LOG_WARNING, "be_new_session() lock: %s", strerror(ret_val));
+        return 0;
+    }
+    old = be->sess;
+    be->sess = sess;
+    if(ret_val = pthread_mutex_unlock(&be->mut))
+        logmsg(LOG_WARNING, "be_new_session() unlock: %s", strerror(ret_val));
+    if(old != NULL)
+        SSL_SESSION_free(old);
+    /* we keep the reference */
+    return 1;
+}
+
+/*
+ * offer the last session with the back-end (if any) for resumption
+ */
+void
+be_resume(BACKEND *const be, SSL *const ssl)
+{
+    int     ret_val;
+
+    if(ret_val = pthread_mutex_lock(&be->mut)) {
+        logmsg(LOG_WARNING, "be_resume() lock: %s", strerror(ret_val));
+        return;
+    }
+    if(be->sess != NULL)
+        SSL_set_session(ssl, be->sess);
+    if(ret_val = pthread_mutex_unlock(&be->mut))
+        logmsg(LOG_WARNING, "be_resume() unlock: %s", strerror(ret_val));
+    return;
+}
+
 #ifndef SSL3_ST_SR_CLNT_HELLO_A
 # define SSL3_ST_SR_CLNT_HELLO_A (0x110|SSL_ST_ACCEPT)
 #endif